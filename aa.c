@@ -0,0 +1,170 @@
+//=== Adaptive anti-aliasing =============================================
+//
+// -aa S supersamples only the pixels on edges.  Once the frame is rendered
+// at native resolution, a pixel whose count differs from one of its 8
+// neighbours by more than -aa-edge is re-sampled with S jittered points,
+// stratified on a sqrt(S) x sqrt(S) grid over the pixel, through the point
+// list kernels, and takes the rounded mean of their counts.  Flat regions,
+// most of a frame, cost nothing more, where uniform supersampling costs S
+// times the whole frame.
+//
+// Jitter comes from a hash of the pixel and sample index, so a frame is
+// reproducible.  Edge pixels go through the kernels AA_BATCH at a time.
+
+#define AA_BATCH 65536          // edge pixels per point list
+
+// integer hash (lowbias32)
+static inline uint32_t
+aa_hash(uint32_t v)
+{
+    v ^= v >> 16;
+    v *= 0x7feb352dU;
+    v ^= v >> 15;
+    v *= 0x846ca68bU;
+    v ^= v >> 16;
+    return v;
+}
+
+// widen row y to u32, replicating the border pixels into row[-1] and row[width]
+static void
+aa_row(const void *data, int elem, int width, int y, uint32_t *row)
+{
+    size_t pos = (size_t) y * width;
+    int x;
+
+    for (x = 0; x < width; x++)
+        row[x] = load_iters(data, pos + x, elem);
+    row[-1] = row[0];
+    row[width] = row[width - 1];
+}
+
+// count of the edge pixels, flagged in edge[]; borders compare to themselves
+static size_t
+aa_edges(const void *data, int elem, int width, int height, unsigned diff, unsigned char *edge)
+{
+    size_t nedge = 0;
+
+#if defined(_OPENMP)
+#pragma omp parallel reduction(+:nedge)
+#endif
+    {
+        uint32_t *rows = malloc(3 * (width + 2) * sizeof(*rows));
+        int y;
+
+        if (!rows)
+            die("aa: out of memory");
+
+#if defined(_OPENMP)
+#pragma omp for schedule(dynamic, 16)
+#endif
+        for (y = 0; y < height; y++) {
+            const uint32_t *r[3];
+            int x, i;
+
+            for (i = 0; i < 3; i++) {
+                int yy = y + i - 1 < 0 ? 0 : y + i - 1 >= height ? height - 1 : y + i - 1;
+
+                aa_row(data, elem, width, yy, rows + i * (width + 2) + 1);
+                r[i] = rows + i * (width + 2) + 1;
+            }
+            for (x = 0; x < width; x++) {
+                uint32_t c = r[1][x], hi = c, lo = c;
+
+                for (i = 0; i < 3; i++) {
+                    hi = r[i][x - 1] > hi ? r[i][x - 1] : hi;
+                    hi = r[i][x] > hi ? r[i][x] : hi;
+                    hi = r[i][x + 1] > hi ? r[i][x + 1] : hi;
+                    lo = r[i][x - 1] < lo ? r[i][x - 1] : lo;
+                    lo = r[i][x] < lo ? r[i][x] : lo;
+                    lo = r[i][x + 1] < lo ? r[i][x + 1] : lo;
+                }
+                edge[(size_t) y * width + x] = hi - c > diff || c - lo > diff;
+                nedge += hi - c > diff || c - lo > diff;
+            }
+        }
+        free(rows);
+    }
+    return nedge;
+}
+
+void
+aa_refine(int samples, unsigned diff, float Re_min, float Re_max, float Im_min, float Im_max, float threshold,
+          int maxiters, int width, int height, int elem, void *data)
+{
+    int grid = (int) lround(sqrt(samples));
+    float dRe = (Re_max - Re_min) / width;
+    float dIm = (Im_max - Im_min) / height;
+    size_t npix = (size_t) width * height, nedge, pos, b, k;
+    unsigned char *edge = malloc(npix);
+    size_t *list;
+    struct points p;
+    uint32_t t1 = get_time(), t2;
+
+    if (!edge)
+        die("aa: out of memory");
+    nedge = aa_edges(data, elem, width, height, diff, edge);
+    t2 = get_time();
+
+    list = malloc((nedge ? nedge : 1) * sizeof(*list));
+    if (!list || !points_alloc(&p, (nedge < AA_BATCH ? nedge : AA_BATCH) * samples))
+        die("aa: out of memory");
+    for (pos = 0, k = 0; pos < npix; pos++)
+        if (edge[pos])
+            list[k++] = pos;
+    free(edge);
+
+    for (b = 0; b < nedge; b += AA_BATCH) {
+        size_t m = nedge - b < AA_BATCH ? nedge - b : AA_BATCH;
+        long i;
+
+        // a shorter last batch, padded to escape at once
+        p.n = m * samples;
+        p.size = (p.n + POINTS_PAD - 1) / POINTS_PAD * POINTS_PAD;
+        for (k = p.n; k < p.size; k++) {
+            p.Cre[k] = p.Cim[k] = 0;
+            p.Zre[k] = p.Zim[k] = FLT_MAX;
+            p.count[k] = 0;
+        }
+
+#if defined(_OPENMP)
+#pragma omp parallel for
+#endif
+        for (i = 0; i < (long) m; i++) {
+            size_t idx = list[b + i];
+            int x = idx % width, y = idx / width, s;
+
+            for (s = 0; s < samples; s++) {
+                uint32_t h = aa_hash((uint32_t) (idx * samples + s));
+                float jx = (s % grid + (h & 0xffff) / 65536.0f) / grid;
+                float jy = (s / grid + (h >> 16) / 65536.0f) / grid;
+                size_t q = (size_t) i * samples + s;
+
+                p.Cre[q] = p.Zre[q] = Re_min + (x + jx) * dRe;
+                p.Cim[q] = p.Zim[q] = Im_min + (y + jy) * dIm;
+                p.count[q] = 0;
+            }
+        }
+
+        points_run(points_function, threshold, maxiters, &p);
+
+#if defined(_OPENMP)
+#pragma omp parallel for
+#endif
+        for (i = 0; i < (long) m; i++) {
+            uint64_t sum = 0;
+            int s;
+
+            for (s = 0; s < samples; s++)
+                sum += p.count[(size_t) i * samples + s];
+            store_iters((char *) data + (size_t) list[b + i] * ELEM_SIZE(elem), elem,
+                        (sum + samples / 2) / samples);
+        }
+    }
+
+    printf("\n  aa: %zu edge pixels (%.1f %%), %zu samples with %s, edges %u us, samples %u us"
+           " (uniform: %zu samples)\n", nedge, 100.0 * nedge / npix, nedge * samples, points_name, t2 - t1,
+           get_time() - t2, npix * samples);
+
+    points_free(&p);
+    free(list);
+}
@@ -0,0 +1,224 @@
+//=== Autotuner ==========================================================
+//
+// -autotune benchmarks every procedure compiled into this binary (and, with
+// openmp, several thread counts and the -pin policies) on representative
+// windows, then the band height of the banded modes (-tile) with the fastest
+// combination, and saves them in a per-host config file.  Later runs without
+// -p load that file automatically.
+
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+#define AUTOTUNE_SIZE 512
+#define AUTOTUNE_RUNS 3
+
+static const struct {
+    float Re_min, Re_max, Im_min, Im_max;
+    int maxiters;
+} autotune_windows[] = {
+    {-2.0, 2.0, -2.0, 2.0, 255},                // default window
+    {-1.0, 1.0, -1.0, 1.0, 1024},               // benchmark window (make run)
+    {0.29768, 0.29778, 0.48354, 0.48364, 400},  // example window (make example)
+};
+
+// -tile candidates, rows per band of -pipeline, -shm, -checkpoint and
+// -coordinator
+static const int autotune_tiles[] = { 16, 32, 64, 128, 256 };
+
+struct config {
+    char procedure[64];
+    int threads;                // 0 = openmp default
+    enum pin_policy pin;        // PIN_NONE = threads not pinned
+    int tile;                   // 0 = -tile default
+};
+
+// default location: ~/.fractal64/<hostname>-<binary>.conf
+// the hostname keeps shared home directories usable across a fleet
+void
+config_default_path(char *path, size_t len, const char *progname)
+{
+    char host[HOST_NAME_MAX + 1] = "localhost";
+    const char *home = getenv("HOME");
+    const char *base = strrchr(progname, '/');
+
+    gethostname(host, sizeof(host) - 1);
+    snprintf(path, len, "%s/.fractal64/%s-%s.conf", home ? home : ".", host, base ? base + 1 : progname);
+}
+
+int
+config_load(const char *path, struct config *cfg)
+{
+    char line[256];
+    FILE *f = fopen(path, "rt");
+    int p;
+
+    if (!f)
+        return 0;
+
+    memset(cfg, 0, sizeof(*cfg));
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (!strncmp(line, "procedure=", 10))
+            snprintf(cfg->procedure, sizeof(cfg->procedure), "%.63s", line + 10);
+        else if (!strncmp(line, "threads=", 8))
+            cfg->threads = atoi(line + 8);
+        else if (!strncmp(line, "tile=", 5))
+            cfg->tile = atoi(line + 5);
+        else if (!strncmp(line, "pin=", 4))
+            for (p = PIN_NONE; p <= PIN_SMT; p++)
+                if (!strcmp(line + 4, pin_names[p]))
+                    cfg->pin = p;
+    }
+    fclose(f);
+    if (cfg->tile <= 0 || cfg->tile % 2)
+        cfg->tile = 0;
+    return cfg->procedure[0] != 0;
+}
+
+void
+config_save(const char *path, const struct config *cfg)
+{
+    char dir[PATH_MAX];
+    char *slash;
+    FILE *f;
+
+    // create the parent directory, ignore failures and let fopen report them
+    snprintf(dir, sizeof(dir), "%s", path);
+    slash = strrchr(dir, '/');
+    if (slash) {
+        *slash = 0;
+        mkdir(dir, 0755);
+    }
+
+    f = fopen(path, "wt");
+    if (!f)
+        die("cannot write config file %s", path);
+    fprintf(f, "procedure=%s\n", cfg->procedure);
+    fprintf(f, "threads=%d\n", cfg->threads);
+    fprintf(f, "pin=%s\n", pin_names[cfg->pin]);
+    if (cfg->tile)
+        fprintf(f, "tile=%d\n", cfg->tile);
+    fclose(f);
+}
+
+void
+config_apply(const struct config *cfg)
+{
+#if defined(_OPENMP)
+    if (cfg->threads > 0)
+        omp_set_num_threads(cfg->threads);
+#endif
+    if (cfg->pin)
+        pin_threads(cfg->pin);
+    else
+        pin_reset();
+}
+
+// best of AUTOTUNE_RUNS, summed over all windows (us), the frame computed in
+// bands of tile rows
+uint32_t
+autotune_measure(mandelbrot_fn function, int tile, void *data)
+{
+    uint32_t total = 0;
+    unsigned w;
+    int r, y0;
+
+    for (w = 0; w < sizeof(autotune_windows) / sizeof(autotune_windows[0]); w++) {
+        uint32_t best = UINT32_MAX;
+        int elem = elem_for_maxiters(autotune_windows[w].maxiters);
+
+        for (r = 0; r < AUTOTUNE_RUNS; r++) {
+            uint32_t t1 = get_time();
+
+            for (y0 = 0; y0 < AUTOTUNE_SIZE; y0 += tile)
+                function(autotune_windows[w].Re_min, autotune_windows[w].Re_max,
+                         autotune_windows[w].Im_min, autotune_windows[w].Im_max, 4.0,
+                         autotune_windows[w].maxiters, AUTOTUNE_SIZE, AUTOTUNE_SIZE, y0,
+                         y0 + tile < AUTOTUNE_SIZE ? tile : AUTOTUNE_SIZE - y0, elem,
+                         (char *) data + (size_t) y0 * AUTOTUNE_SIZE * ELEM_SIZE(elem));
+            t1 = get_time() - t1;
+            best = t1 < best ? t1 : best;
+        }
+        total += best;
+    }
+    return total;
+}
+
+void
+autotune(const char *path, void *data)
+{
+    struct config best = { "", 0, PIN_NONE, 0 };
+    const struct procedure *winner = NULL;
+    uint32_t best_time = UINT32_MAX;
+    int threads[3] = { 0, 0, 0 };
+    int nthreads = 1;
+    int p, t, pin, npins;
+
+#if defined(_OPENMP)
+    // one thread, one thread per core, one thread per hyperthread
+    threads[0] = 1;
+    threads[1] = topo.ncores;
+    threads[2] = topo.ncpus;
+    nthreads = 3;
+#endif
+
+    printf("Autotune %d x %d, %d windows\n", AUTOTUNE_SIZE, AUTOTUNE_SIZE,
+           (int) (sizeof(autotune_windows) / sizeof(autotune_windows[0])));
+
+    for (p = 0; procedures[p].name; p++) {
+        // Julia and Multibrot procedures render other fractals
+        if (procedures[p].fractal != FRACTAL_MANDELBROT)
+            continue;
+        for (t = 0; t < nthreads; t++) {
+            // serial procedures do not depend on the thread count
+            if (t && !procedures[p].threaded)
+                break;
+            if (t && threads[t] == threads[t - 1])
+                continue;
+
+            // every policy places a single thread on the same first cpu
+            npins = procedures[p].threaded && threads[t] > 1 ? PIN_SMT + 1 : PIN_COMPACT + 1;
+            for (pin = PIN_NONE; pin < npins; pin++) {
+                struct config cfg;
+                uint32_t us;
+
+                snprintf(cfg.procedure, sizeof(cfg.procedure), "%s", procedures[p].name);
+                cfg.threads = procedures[p].threaded ? threads[t] : 0;
+                cfg.pin = pin;
+                cfg.tile = 0;
+                config_apply(&cfg);
+
+                us = autotune_measure(procedures[p].function, AUTOTUNE_SIZE, data);
+                printf("%-20s threads=%-3d pin=%-8s %d us\n", cfg.procedure, cfg.threads, pin_names[pin], us);
+                if (us < best_time) {
+                    best_time = us;
+                    best = cfg;
+                    winner = &procedures[p];
+                }
+            }
+        }
+    }
+
+    // band height of the banded modes, with the fastest configuration
+    config_apply(&best);
+    best_time = UINT32_MAX;
+    for (t = 0; winner && t < (int) (sizeof(autotune_tiles) / sizeof(autotune_tiles[0])); t++) {
+        uint32_t us = autotune_measure(winner->function, autotune_tiles[t], data);
+
+        printf("%-20s threads=%-3d pin=%-8s tile=%-4d %d us\n", best.procedure, best.threads,
+               pin_names[best.pin], autotune_tiles[t], us);
+        if (us < best_time) {
+            best_time = us;
+            best.tile = autotune_tiles[t];
+        }
+    }
+
+    config_save(path, &best);
+    printf("Best: %s threads=%d pin=%s tile=%d, saved to %s\n", best.procedure, best.threads, pin_names[best.pin],
+           best.tile, path);
+}
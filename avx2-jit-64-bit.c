@@ -0,0 +1,412 @@
+//=== AVX2+FMA JIT - 64-bit code ========================================
+//
+// AVX2+FMA+JIT emits, for the threshold and maxiters of the render, the
+// machine code of the AVX2_FMA_STITCH_mandelbrot block: two strands of 8
+// pixels, unroll by 8 with rollback, then the one step tail of each
+// strand.  maxiters and miniters are immediates, the threshold is a
+// constant of the code, the miniters loop is left out when maxiters < 8,
+// and when maxiters is a multiple of 8 the blocks which run all miniters
+// iterations store the constant count and return without a tail.
+//
+// A small VEX encoder covers the few instructions used.  The code is
+// written in a private anonymous mapping which is then made executable and
+// read only.  Before use it renders a probe window, which must match
+// AVX2_FMA_STITCH_mandelbrot exactly, else the static procedure is used.
+// The code is kept until a render asks for another threshold or maxiters.
+
+#include <sys/mman.h>
+
+#define JIT_SIZE  4096          // bytes of code and constants
+#define JIT_PROBE 32            // probe window pixels, each way
+#define JIT_THRESHOLD (JIT_SIZE - 4)    // constants at the end of the code
+#define JIT_MAXITERS  (JIT_SIZE - 8)
+
+// generated block: in = Cre, Cim0, Cim1 (8 floats each, 32 bytes aligned),
+// out = counts of the two strands (8 uint32 each)
+typedef void (*jit_block_fn) (const float *in, uint32_t *out);
+
+struct jit {
+    unsigned char *code;
+    size_t len;
+};
+
+// VEX prefixes (pp) and opcode maps (m-mmmm)
+#define JIT_NP   0
+#define JIT_66   1
+#define JIT_F3   2
+#define JIT_0F   1
+#define JIT_0F38 2
+
+// ymm registers of the generated code
+enum {
+    JIT_CRE = 0, JIT_CIM0, JIT_CIM1,            // inputs
+    JIT_XRE0, JIT_XIM0, JIT_XRE1, JIT_XIM1,     // z of the two strands
+    JIT_S0, JIT_S1, JIT_S2, JIT_S3,             // rollback copies, then tail temporaries
+    JIT_THR,                                    // threshold
+    JIT_T0, JIT_T1, JIT_T2, JIT_T3              // temporaries
+};
+
+static void
+jit_byte(struct jit *j, int b)
+{
+    if (j->len >= JIT_MAXITERS)
+        die("jit: code buffer overflow");
+    j->code[j->len++] = b;
+}
+
+static void
+jit_u32(struct jit *j, uint32_t v)
+{
+    int i;
+
+    for (i = 0; i < 4; i++)
+        jit_byte(j, v >> 8 * i & 0xff);
+}
+
+// 3 bytes VEX prefix and opcode; reg, vvvv, rm are register numbers, the
+// inverted R, B and vvvv fields are computed here
+static void
+jit_vex(struct jit *j, int pp, int map, int l, int reg, int vvvv, int rm, int opcode)
+{
+    jit_byte(j, 0xc4);
+    jit_byte(j, (reg & 8 ? 0 : 0x80) | 0x40 | (rm & 8 ? 0 : 0x20) | map);
+    jit_byte(j, (~vvvv & 15) << 3 | l << 2 | pp);
+    jit_byte(j, opcode);
+}
+
+// dst = src1 op src2, 256 bits, register operands
+static void
+jit_op(struct jit *j, int pp, int map, int opcode, int dst, int src1, int src2)
+{
+    jit_vex(j, pp, map, 1, dst, src1, src2, opcode);
+    jit_byte(j, 0xc0 | (dst & 7) << 3 | (src2 & 7));
+}
+
+// reg and [base + disp8], base rdi (7) or rsi (6)
+static void
+jit_mem(struct jit *j, int pp, int map, int opcode, int reg, int base, int disp)
+{
+    jit_vex(j, pp, map, 1, reg, 0, 0, opcode);
+    jit_byte(j, 0x40 | (reg & 7) << 3 | base);
+    jit_byte(j, disp);
+}
+
+// reg and [rip + disp32] of a constant, at offset pos of the code
+static void
+jit_rip(struct jit *j, int pp, int map, int opcode, int reg, size_t pos)
+{
+    jit_vex(j, pp, map, 1, reg, 0, 0, opcode);
+    jit_byte(j, 0x05 | (reg & 7) << 3);
+    jit_u32(j, pos - (j->len + 4));
+}
+
+#define jit_vmovaps(j, d, s)        jit_op(j, JIT_NP, JIT_0F, 0x28, d, 0, s)
+#define jit_vmulps(j, d, a, b)      jit_op(j, JIT_NP, JIT_0F, 0x59, d, a, b)
+#define jit_vaddps(j, d, a, b)      jit_op(j, JIT_NP, JIT_0F, 0x58, d, a, b)
+#define jit_vsubps(j, d, a, b)      jit_op(j, JIT_NP, JIT_0F, 0x5c, d, a, b)
+#define jit_vandps(j, d, a, b)      jit_op(j, JIT_NP, JIT_0F, 0x54, d, a, b)
+#define jit_vpsubd(j, d, a, b)      jit_op(j, JIT_66, JIT_0F, 0xfa, d, a, b)
+#define jit_vptest(j, a, b)         jit_op(j, JIT_66, JIT_0F38, 0x17, a, 0, b)
+#define jit_vfmsub231ps(j, d, a, b) jit_op(j, JIT_66, JIT_0F38, 0xba, d, a, b)     // d = a * b - d
+#define jit_vfmsub213ps(j, d, a, b) jit_op(j, JIT_66, JIT_0F38, 0xaa, d, a, b)     // d = a * d - b
+#define jit_vfmadd231ps(j, d, a, b) jit_op(j, JIT_66, JIT_0F38, 0xb8, d, a, b)     // d = a * b + d
+#define jit_vmovmskps(j, r32, s)    jit_op(j, JIT_NP, JIT_0F, 0x50, r32, 0, s)
+#define jit_vpbroadcastd(j, d, s)   jit_op(j, JIT_66, JIT_0F38, 0x58, d, 0, s)
+
+// d = a <= b (ordered, signaling)
+static void
+jit_vcmpleps(struct jit *j, int d, int a, int b)
+{
+    jit_op(j, JIT_NP, JIT_0F, 0xc2, d, a, b);
+    jit_byte(j, _CMP_LE_OS);
+}
+
+// xmm d = eax
+static void
+jit_vmovd_eax(struct jit *j, int d)
+{
+    jit_vex(j, JIT_66, JIT_0F, 0, d, 0, 0, 0x6e);
+    jit_byte(j, 0xc0 | (d & 7) << 3);
+}
+
+// jcc (cc = 0x0 .. 0xf) or, with cc < 0, jmp to the code offset target;
+// returns the offset of the rel32 for forward jumps patched later
+static size_t
+jit_jump(struct jit *j, int cc, size_t target)
+{
+    size_t at;
+
+    if (cc < 0) {
+        jit_byte(j, 0xe9);
+    } else {
+        jit_byte(j, 0x0f);
+        jit_byte(j, 0x80 | cc);
+    }
+    at = j->len;
+    jit_u32(j, target - (at + 4));
+    return at;
+}
+
+static void
+jit_patch(struct jit *j, size_t at)
+{
+    uint32_t rel = j->len - (at + 4);
+
+    memcpy(j->code + at, &rel, 4);
+}
+
+#define JIT_JB  0x2
+#define JIT_JE  0x4
+#define JIT_JNE 0x5
+#define JIT_JGE 0xd
+
+// z = z^2 + c on both strands, the operations of AVX2_FMA_STITCH_mandelbrot
+static void
+jit_step2(struct jit *j)
+{
+    jit_vmulps(j, JIT_T0, JIT_XRE0, JIT_XIM0);
+    jit_vmulps(j, JIT_T2, JIT_XRE1, JIT_XIM1);
+    jit_vmovaps(j, JIT_T1, JIT_CRE);
+    jit_vmovaps(j, JIT_T3, JIT_CRE);
+    jit_vfmsub231ps(j, JIT_T1, JIT_XIM0, JIT_XIM0);
+    jit_vfmsub231ps(j, JIT_T3, JIT_XIM1, JIT_XIM1);
+    jit_vaddps(j, JIT_T0, JIT_T0, JIT_T0);
+    jit_vaddps(j, JIT_T2, JIT_T2, JIT_T2);
+    jit_vaddps(j, JIT_XIM0, JIT_CIM0, JIT_T0);
+    jit_vaddps(j, JIT_XIM1, JIT_CIM1, JIT_T2);
+    jit_vfmsub213ps(j, JIT_XRE0, JIT_XRE0, JIT_T1);
+    jit_vfmsub213ps(j, JIT_XRE1, JIT_XRE1, JIT_T3);
+}
+
+// one step tail of a strand from eax to maxiters, counts stored at [rsi + disp]
+static void
+jit_tail(struct jit *j, int Xre, int Xim, int Cim, int maxiters, int disp)
+{
+    size_t top, done[2];
+
+    jit_vmovaps(j, JIT_T3, JIT_S2);     // count = i
+    jit_byte(j, 0x89);                  // mov ecx, eax
+    jit_byte(j, 0xc1);
+    jit_vmulps(j, JIT_T0, Xre, Xre);
+    jit_vmulps(j, JIT_T1, Xim, Xim);
+    jit_vmulps(j, JIT_T2, Xre, Xim);
+
+    top = j->len;
+    jit_byte(j, 0x81);                  // cmp ecx, maxiters
+    jit_byte(j, 0xf9);
+    jit_u32(j, maxiters);
+    done[0] = jit_jump(j, JIT_JGE, 0);
+    jit_byte(j, 0xff);                  // inc ecx
+    jit_byte(j, 0xc1);
+    jit_vaddps(j, JIT_S0, JIT_T0, JIT_T1);
+    jit_vaddps(j, JIT_S1, JIT_T0, JIT_CRE);     // (Xre2 + Cre) - Xim2, as -ffast-math compiles
+    jit_vsubps(j, Xre, JIT_S1, JIT_T1);         // the Cre + (Xre2 - Xim2) of the C tail
+    jit_vcmpleps(j, JIT_S0, JIT_S0, JIT_THR);
+    jit_vaddps(j, JIT_S1, JIT_T2, JIT_T2);
+    jit_vaddps(j, Xim, Cim, JIT_S1);
+    jit_vptest(j, JIT_S0, JIT_S0);
+    done[1] = jit_jump(j, JIT_JE, 0);
+    jit_vpsubd(j, JIT_T3, JIT_T3, JIT_S0);
+    jit_vmulps(j, JIT_T0, Xre, Xre);
+    jit_vmulps(j, JIT_T1, Xim, Xim);
+    jit_vmulps(j, JIT_T2, Xre, Xim);
+    jit_jump(j, -1, top);
+
+    jit_patch(j, done[0]);
+    jit_patch(j, done[1]);
+    jit_mem(j, JIT_F3, JIT_0F, 0x7f, JIT_T3, 6, disp);  // vmovdqu [rsi + disp], count
+}
+
+static void
+jit_return(struct jit *j)
+{
+    jit_byte(j, 0xc5);                  // vzeroupper
+    jit_byte(j, 0xf8);
+    jit_byte(j, 0x77);
+    jit_byte(j, 0xc3);                  // ret
+}
+
+static void
+jit_generate(struct jit *j, float threshold, int maxiters)
+{
+    int miniters = maxiters & ~7, k;
+    size_t top, rollback, skip = 0;
+
+    jit_mem(j, JIT_NP, JIT_0F, 0x10, JIT_CRE, 7, 0);    // vmovups from [rdi]
+    jit_mem(j, JIT_NP, JIT_0F, 0x10, JIT_CIM0, 7, 32);
+    jit_mem(j, JIT_NP, JIT_0F, 0x10, JIT_CIM1, 7, 64);
+    jit_rip(j, JIT_66, JIT_0F38, 0x18, JIT_THR, JIT_THRESHOLD);        // vbroadcastss
+    jit_vmovaps(j, JIT_XRE0, JIT_CRE);
+    jit_vmovaps(j, JIT_XIM0, JIT_CIM0);
+    jit_vmovaps(j, JIT_XRE1, JIT_CRE);
+    jit_vmovaps(j, JIT_XIM1, JIT_CIM1);
+    jit_byte(j, 0x31);                  // xor eax, eax
+    jit_byte(j, 0xc0);
+
+    if (miniters) {
+        top = j->len;
+        jit_vmovaps(j, JIT_S0, JIT_XRE0);
+        jit_vmovaps(j, JIT_S1, JIT_XIM0);
+        jit_vmovaps(j, JIT_S2, JIT_XRE1);
+        jit_vmovaps(j, JIT_S3, JIT_XIM1);
+        for (k = 0; k < 8; k++)
+            jit_step2(j);
+
+        jit_vmulps(j, JIT_T0, JIT_XRE0, JIT_XRE0);
+        jit_vmulps(j, JIT_T2, JIT_XRE1, JIT_XRE1);
+        jit_vfmadd231ps(j, JIT_T0, JIT_XIM0, JIT_XIM0);
+        jit_vfmadd231ps(j, JIT_T2, JIT_XIM1, JIT_XIM1);
+        jit_vcmpleps(j, JIT_T0, JIT_T0, JIT_THR);
+        jit_vcmpleps(j, JIT_T2, JIT_T2, JIT_THR);
+        jit_vandps(j, JIT_T0, JIT_T0, JIT_T2);
+        jit_vmovmskps(j, 1, JIT_T0);    // ecx
+        jit_byte(j, 0x81);              // cmp ecx, 0xff
+        jit_byte(j, 0xf9);
+        jit_u32(j, 0xff);
+        rollback = jit_jump(j, JIT_JNE, 0);
+        jit_byte(j, 0x83);              // add eax, 8
+        jit_byte(j, 0xc0);
+        jit_byte(j, 8);
+        jit_byte(j, 0x3d);              // cmp eax, miniters
+        jit_u32(j, miniters);
+        jit_jump(j, JIT_JB, top);
+
+        if (miniters == maxiters) {
+            // every lane ran maxiters iterations
+            jit_rip(j, JIT_66, JIT_0F38, 0x18, JIT_T3, JIT_MAXITERS);
+            jit_mem(j, JIT_F3, JIT_0F, 0x7f, JIT_T3, 6, 0);
+            jit_mem(j, JIT_F3, JIT_0F, 0x7f, JIT_T3, 6, 32);
+            jit_return(j);
+        } else {
+            skip = jit_jump(j, -1, 0);
+        }
+
+        jit_patch(j, rollback);
+        jit_vmovaps(j, JIT_XRE0, JIT_S0);
+        jit_vmovaps(j, JIT_XIM0, JIT_S1);
+        jit_vmovaps(j, JIT_XRE1, JIT_S2);
+        jit_vmovaps(j, JIT_XIM1, JIT_S3);
+        if (miniters != maxiters)
+            jit_patch(j, skip);
+    }
+
+    // i = eax in every lane
+    jit_vmovd_eax(j, JIT_S2);
+    jit_vpbroadcastd(j, JIT_S2, JIT_S2);
+    jit_tail(j, JIT_XRE0, JIT_XIM0, JIT_CIM0, maxiters, 0);
+    jit_tail(j, JIT_XRE1, JIT_XIM1, JIT_CIM1, maxiters, 32);
+    jit_return(j);
+
+    memcpy(j->code + JIT_THRESHOLD, &threshold, 4);
+    memcpy(j->code + JIT_MAXITERS, &maxiters, 4);
+}
+
+// the AVX2_FMA_STITCH_mandelbrot loops around the generated block
+static void
+jit_render(jit_block_fn block, float Re_min, float Re_max, float Im_min, float Im_max, int width, int height, int y0,
+           int rows, int elem, void *data)
+{
+    float dRe = (Re_max - Re_min) / width;
+    float dIm = (Im_max - Im_min) / height;
+    __m256 vec_dRe = _mm256_set1_ps(8 * dRe);
+    int y;
+
+#if defined(_OPENMP)
+#pragma omp parallel for
+#endif
+    for (y = 0; y < rows; y += 2) {
+        if (render_cancelled())
+            continue;
+
+        float __attribute__ ((aligned(32))) in[24];
+        uint32_t __attribute__ ((aligned(32))) out[16];
+        __m256 Cim0 = _mm256_add_ps(_mm256_set1_ps(Im_min), _mm256_set1_ps((y0 + y) * dIm));
+        __m256 Cim1 = _mm256_add_ps(Cim0, _mm256_set1_ps(dIm));
+        __m256 Cre = _mm256_add_ps(_mm256_set1_ps(Re_min),
+                                   _mm256_setr_ps(0 * dRe, 1 * dRe, 2 * dRe, 3 * dRe,
+                                                  4 * dRe, 5 * dRe, 6 * dRe, 7 * dRe));
+        char *ptr0 = (char *) data + (size_t) y * width * ELEM_SIZE(elem);
+        char *ptr1 = ptr0 + (size_t) width * ELEM_SIZE(elem);
+        int x;
+
+        _mm256_store_ps(in + 8, Cim0);
+        _mm256_store_ps(in + 16, Cim1);
+        for (x = 0; x < width; x += 8) {
+            _mm256_store_ps(in, Cre);
+            block(in, out);
+            AVX2_store(_mm256_load_si256((__m256i *) out), ptr0, elem);
+            AVX2_store(_mm256_load_si256((__m256i *) (out + 8)), ptr1, elem);
+            ptr0 += 8 * ELEM_SIZE(elem);
+            ptr1 += 8 * ELEM_SIZE(elem);
+            Cre = _mm256_add_ps(Cre, vec_dRe);
+        }
+
+        // order non-temporal stores (ELEM_STREAM) before the openmp barrier
+        _mm_sfence();
+        progress_rows(2, (char *) data + (size_t) y * width * ELEM_SIZE(elem), 2 * (size_t) width, elem);
+    }
+}
+
+// code for the last threshold and maxiters; block is NULL when the probe
+// did not match and the static procedure stands in
+static struct {
+    unsigned char *code;
+    jit_block_fn block;
+    float threshold;
+    int maxiters;
+} jit_cache;
+
+static jit_block_fn
+jit_get(float threshold, int maxiters)
+{
+    static uint32_t probe[2][JIT_PROBE * JIT_PROBE];
+    struct jit j;
+    uint32_t t1 = get_time();
+    int same, report;
+
+    if (jit_cache.code && jit_cache.threshold == threshold && jit_cache.maxiters == maxiters)
+        return jit_cache.block;
+    if (jit_cache.code)
+        munmap(jit_cache.code, JIT_SIZE);
+
+    j.code = mmap(NULL, JIT_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (j.code == MAP_FAILED)
+        die("jit: cannot map code buffer");
+    j.len = 0;
+    jit_generate(&j, threshold, maxiters);
+    if (mprotect(j.code, JIT_SIZE, PROT_READ | PROT_EXEC))
+        die("jit: cannot make code executable");
+
+    jit_cache.code = j.code;
+    jit_cache.block = (jit_block_fn) (uintptr_t) j.code;
+    jit_cache.threshold = threshold;
+    jit_cache.maxiters = maxiters;
+
+    // probe window across the boundary of the set, not part of the frame progress
+    report = __atomic_exchange_n(&progress_on, 0, __ATOMIC_RELAXED);
+    jit_render(jit_cache.block, -2.0, 0.5, -1.25, 1.25, JIT_PROBE, JIT_PROBE, 0, JIT_PROBE, ELEM_U32, probe[0]);
+    AVX2_FMA_STITCH_mandelbrot(-2.0, 0.5, -1.25, 1.25, threshold, maxiters, JIT_PROBE, JIT_PROBE, 0, JIT_PROBE,
+                               ELEM_U32, probe[1]);
+    __atomic_store_n(&progress_on, report, __ATOMIC_RELAXED);
+    same = !memcmp(probe[0], probe[1], sizeof(probe[0]));
+    if (!same)
+        jit_cache.block = NULL;
+
+    printf("\n  jit: %zu bytes of code for maxiters %d, threshold %g, %u us, probe %s\n", j.len, maxiters,
+           threshold, get_time() - t1,
+           same ? "matches AVX2+FMA+STITCH" : "differs from AVX2+FMA+STITCH, using it instead");
+    return jit_cache.block;
+}
+
+void
+AVX2_FMA_JIT_mandelbrot(float Re_min, float Re_max, float Im_min, float Im_max, float threshold, int maxiters,
+                        int width, int height, int y0, int rows, int elem, void *data)
+{
+    jit_block_fn block = jit_get(threshold, maxiters);
+
+    if (block)
+        jit_render(block, Re_min, Re_max, Im_min, Im_max, width, height, y0, rows, elem, data);
+    else
+        AVX2_FMA_STITCH_mandelbrot(Re_min, Re_max, Im_min, Im_max, threshold, maxiters, width, height, y0, rows,
+                                   elem, data);
+}
@@ -1,14 +1,49 @@
 //=== AVX2 implementation - 64-bit code ==================================
 #include <immintrin.h>
 
+// store 8 iteration counts as u8 (saturating), u16 (saturating) or u32
+// ELEM_STREAM uses non-temporal stores, see SSE_store()
+static inline void
+AVX2_store(__m256i itercount, void *ptr, int elem)
+{
+    __m128i t1;
+
+    switch (elem) {
+    case ELEM_U8:
+    case ELEM_U8 | ELEM_STREAM:
+        t1 = _mm_packus_epi32(_mm256_castsi256_si128(itercount), _mm256_extracti128_si256(itercount, 1));
+        t1 = _mm_packus_epi16(t1, t1);
+        if (elem & ELEM_STREAM)
+            _mm_stream_si64((long long *) ptr, _mm_cvtsi128_si64(t1));
+        else
+            _mm_storel_epi64((__m128i *) ptr, t1);
+        break;
+    case ELEM_U16:
+    case ELEM_U16 | ELEM_STREAM:
+        t1 = _mm_packus_epi32(_mm256_castsi256_si128(itercount), _mm256_extracti128_si256(itercount, 1));
+        if (elem & ELEM_STREAM)
+            _mm_stream_si128((__m128i *) ptr, t1);
+        else
+            _mm_storeu_si128((__m128i *) ptr, t1);
+        break;
+    case ELEM_U32 | ELEM_STREAM:
+        _mm256_stream_si256((__m256i *) ptr, itercount);
+        break;
+    default:
+        _mm256_storeu_si256((__m256i *) ptr, itercount);
+        break;
+    }
+}
+
 void
 AVX2_mandelbrot(float Re_min, float Re_max,
-                float Im_min, float Im_max, float threshold, int maxiters, int width, int height, uint16_t * data)
+                float Im_min, float Im_max, float threshold, int maxiters,
+                int width, int height, int y0, int rows, int elem, void *data)
 {
     float dRe, dIm;
     int x, y, i;
 
-    uint64_t *ptr = (uint64_t *) data;
+    char *ptr = data;
 
     _mm256_zeroall();
 
@@ -21,9 +56,9 @@ AVX2_mandelbrot(float Re_min, float Re_max,
     __m256 vec_threshold = _mm256_set1_ps(threshold);
 
     // 2. Cim
-    __m256 Cim = _mm256_set1_ps(Im_min);
+    __m256 Cim = _mm256_set1_ps(band_im(Im_min, dIm, y0));
     __m256 Cre, Xre, Xim, Xre2, Xim2, Xrm, cmp;
-    __m256i itercount, itershuffle;
+    __m256i itercount;
 
     // 3. Re advance every x iteration
     __m256 vec_dRe = _mm256_set1_ps(8 * dRe);
@@ -32,7 +67,9 @@ AVX2_mandelbrot(float Re_min, float Re_max,
     __m256 vec_dIm = _mm256_set1_ps(dIm);
 
     // calculations
-    for (y = 0; y < height; y++) {
+    for (y = 0; y < rows; y++) {
+        if (render_cancelled())
+            break;
 
         Cre = _mm256_setr_ps(Re_min + 0 * dRe, Re_min + 1 * dRe, Re_min + 2 * dRe, Re_min + 3 * dRe,
                              Re_min + 4 * dRe, Re_min + 5 * dRe, Re_min + 6 * dRe, Re_min + 7 * dRe);
@@ -58,17 +95,8 @@ AVX2_mandelbrot(float Re_min, float Re_max,
                 Xrm = _mm256_mul_ps(Xre, Xim);
             }
 
-            itershuffle = _mm256_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13,
-                                           (char) 0xff, (char) 0xff, (char) 0xff, (char) 0xff,
-                                           (char) 0xff, (char) 0xff, (char) 0xff, (char) 0xff,
-                                           16, 17, 20, 21, 24, 25, 28, 29,
-                                           (char) 0xff, (char) 0xff, (char) 0xff, (char) 0xff,
-                                           (char) 0xff, (char) 0xff, (char) 0xff, (char) 0xff);
-
-            itercount = _mm256_shuffle_epi8(itercount, itershuffle);
-
-            *ptr++ = _mm256_extract_epi64(itercount, 0);
-            *ptr++ = _mm256_extract_epi64(itercount, 2);
+            AVX2_store(itercount, ptr, elem);
+            ptr += 8 * ELEM_SIZE(elem);
 
             // advance Cre vector
             Cre = _mm256_add_ps(Cre, vec_dRe);
@@ -76,7 +104,161 @@ AVX2_mandelbrot(float Re_min, float Re_max,
 
         // advance Cim vector
         Cim = _mm256_add_ps(Cim, vec_dIm);
+        progress_rows(1, (char *) data + (size_t) y * width * ELEM_SIZE(elem), width, elem);
     }
+
+    // order non-temporal stores (ELEM_STREAM)
+    _mm_sfence();
+}
+
+//=== AVX2 implementation, fixed point ===================================
+// FPU_FIXED_mandelbrot on 8 pixels at a time, two vectors of 4 Q7.56 lanes.
+// AVX2 has no 64-bit multiply: products are taken on the magnitudes from
+// four (three for squares) 32x32->64 bit _mm256_mul_epu32 partial products,
+// carries included, so they truncate exactly as the 128-bit scalar product.
+// Every iteration is tested, as an overflowed lane wraps around instead of
+// growing and the unroll/rollback scheme could miss it.
+
+static const int64_t __attribute__ ((aligned(32))) AVX2_fixed_low32[4] = {
+    0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff
+};
+
+// (hi:mid:lo 128-bit product) >> FIXED_FRAC, with mid holding the bits
+// 32..63 in its low half and their carry above
+static inline __m256i
+AVX2_fixed_shift(__m256i hi, __m256i mid)
+{
+    __m256i low32 = _mm256_load_si256((const __m256i *) AVX2_fixed_low32);
+
+    hi = _mm256_add_epi64(hi, _mm256_srli_epi64(mid, 32));
+    return _mm256_or_si256(_mm256_slli_epi64(hi, 64 - FIXED_FRAC),
+                           _mm256_srli_epi64(_mm256_and_si256(mid, low32), FIXED_FRAC - 32));
+}
+
+// a * b >> FIXED_FRAC for a, b >= 0
+static inline __m256i
+AVX2_fixed_mul(__m256i a, __m256i b)
+{
+    __m256i low32 = _mm256_load_si256((const __m256i *) AVX2_fixed_low32);
+    __m256i a1 = _mm256_srli_epi64(a, 32);
+    __m256i b1 = _mm256_srli_epi64(b, 32);
+    __m256i lo = _mm256_mul_epu32(a, b);
+    __m256i m1 = _mm256_mul_epu32(a1, b);
+    __m256i m2 = _mm256_mul_epu32(a, b1);
+    __m256i hi = _mm256_mul_epu32(a1, b1);
+    __m256i mid;
+
+    mid = _mm256_add_epi64(_mm256_srli_epi64(lo, 32), _mm256_and_si256(m1, low32));
+    mid = _mm256_add_epi64(mid, _mm256_and_si256(m2, low32));
+    hi = _mm256_add_epi64(hi, _mm256_srli_epi64(m1, 32));
+    hi = _mm256_add_epi64(hi, _mm256_srli_epi64(m2, 32));
+    return AVX2_fixed_shift(hi, mid);
+}
+
+// a * a >> FIXED_FRAC for a >= 0
+static inline __m256i
+AVX2_fixed_sqr(__m256i a)
+{
+    __m256i low32 = _mm256_load_si256((const __m256i *) AVX2_fixed_low32);
+    __m256i a1 = _mm256_srli_epi64(a, 32);
+    __m256i lo = _mm256_mul_epu32(a, a);
+    __m256i m = _mm256_mul_epu32(a1, a);
+    __m256i hi = _mm256_mul_epu32(a1, a1);
+    __m256i mid, mm = _mm256_srli_epi64(m, 32);
+
+    m = _mm256_and_si256(m, low32);
+    mid = _mm256_add_epi64(_mm256_srli_epi64(lo, 32), _mm256_add_epi64(m, m));
+    hi = _mm256_add_epi64(hi, _mm256_add_epi64(mm, mm));
+    return AVX2_fixed_shift(hi, mid);
+}
+
+// one iteration of 4 lanes; returns the lanes which stay in, all bits set
+static inline __m256i
+AVX2_fixed_step(__m256i *Xre, __m256i *Xim, __m256i Cre, __m256i Cim, __m256i R, __m256i T)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i sre = _mm256_cmpgt_epi64(zero, *Xre);
+    __m256i sim = _mm256_cmpgt_epi64(zero, *Xim);
+    __m256i are = _mm256_sub_epi64(_mm256_xor_si256(*Xre, sre), sre);
+    __m256i aim = _mm256_sub_epi64(_mm256_xor_si256(*Xim, sim), sim);
+    __m256i Xre2 = AVX2_fixed_sqr(are);
+    __m256i Xim2 = AVX2_fixed_sqr(aim);
+    __m256i Xrm = AVX2_fixed_mul(are, aim);
+    __m256i s = _mm256_xor_si256(sre, sim);
+    __m256i out;
+
+    out = _mm256_or_si256(_mm256_cmpgt_epi64(are, R), _mm256_cmpgt_epi64(aim, R));
+    out = _mm256_or_si256(out, _mm256_cmpgt_epi64(_mm256_add_epi64(Xre2, Xim2), T));
+
+    Xrm = _mm256_sub_epi64(_mm256_xor_si256(Xrm, s), s);
+    *Xim = _mm256_add_epi64(_mm256_add_epi64(Xrm, Xrm), Cim);
+    *Xre = _mm256_add_epi64(_mm256_sub_epi64(Xre2, Xim2), Cre);
+    return _mm256_xor_si256(out, _mm256_set1_epi64x(-1));
+}
+
+void
+AVX2_FIXED_mandelbrot(float Re_min, float Re_max, float Im_min, float Im_max, float threshold, int maxiters,
+                      int width, int height, int y0, int rows, int elem, void *data)
+{
+    int64_t dRe = fixed_from_double(((double) Re_max - Re_min) / width);
+    int64_t dIm = fixed_from_double(((double) Im_max - Im_min) / height);
+    int64_t Re0 = fixed_from_double(Re_min), Im0 = fixed_from_double(Im_min);
+    int64_t R, T;
+    int x, y, i;
+
+    char *ptr = data;
+
+    fixed_threshold(threshold, &R, &T);
+
+    // prepare vectors
+    __m256i vec_R = _mm256_set1_epi64x(R);
+    __m256i vec_T = _mm256_set1_epi64x(T);
+    __m256i vec_dRe = _mm256_set1_epi64x(8 * dRe);
+    __m256i even = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+    __m256i Cre_a, Cre_b, Cim, Xre_a, Xim_a, Xre_b, Xim_b, active_a, active_b, count_a, count_b, itercount;
+
+    for (y = 0; y < rows; y++) {
+        if (render_cancelled())
+            break;
+
+        Cim = _mm256_set1_epi64x(Im0 + (y0 + y) * dIm);
+        Cre_a = _mm256_setr_epi64x(Re0, Re0 + dRe, Re0 + 2 * dRe, Re0 + 3 * dRe);
+        Cre_b = _mm256_add_epi64(Cre_a, _mm256_set1_epi64x(4 * dRe));
+
+        for (x = 0; x < width; x += 8) {
+
+            Xre_a = Cre_a;
+            Xim_a = Cim;
+            Xre_b = Cre_b;
+            Xim_b = Cim;
+            active_a = active_b = _mm256_set1_epi64x(-1);
+            count_a = count_b = _mm256_setzero_si256();
+
+            for (i = 0; i < maxiters; i++) {
+                active_a = _mm256_and_si256(active_a, AVX2_fixed_step(&Xre_a, &Xim_a, Cre_a, Cim, vec_R, vec_T));
+                active_b = _mm256_and_si256(active_b, AVX2_fixed_step(&Xre_b, &Xim_b, Cre_b, Cim, vec_R, vec_T));
+                if (_mm256_testz_si256(_mm256_or_si256(active_a, active_b), _mm256_or_si256(active_a, active_b)))
+                    break;
+                count_a = _mm256_sub_epi64(count_a, active_a);
+                count_b = _mm256_sub_epi64(count_b, active_b);
+            }
+
+            // low halves of the 64-bit counts, in pixel order
+            count_a = _mm256_permutevar8x32_epi32(count_a, even);
+            count_b = _mm256_permutevar8x32_epi32(count_b, even);
+            itercount = _mm256_permute2x128_si256(count_a, count_b, 0x20);
+
+            AVX2_store(itercount, ptr, elem);
+            ptr += 8 * ELEM_SIZE(elem);
+
+            Cre_a = _mm256_add_epi64(Cre_a, vec_dRe);
+            Cre_b = _mm256_add_epi64(Cre_b, vec_dRe);
+        }
+        progress_rows(1, (char *) data + (size_t) y * width * ELEM_SIZE(elem), width, elem);
+    }
+
+    // order non-temporal stores (ELEM_STREAM)
+    _mm_sfence();
 }
 
 #if defined(FMA)
@@ -85,12 +267,13 @@ AVX2_mandelbrot(float Re_min, float Re_max,
 
 void
 AVX2_FMA_mandelbrot(float Re_min, float Re_max,
-                    float Im_min, float Im_max, float threshold, int maxiters, int width, int height, uint16_t * data)
+                    float Im_min, float Im_max, float threshold, int maxiters,
+                    int width, int height, int y0, int rows, int elem, void *data)
 {
     float dRe, dIm;
     int x, y, i, j;
 
-    uint64_t *ptr = (uint64_t *) data;
+    char *ptr = data;
     int miniters = maxiters & ~7;
 
     // step on Re and Im axis
@@ -105,7 +288,7 @@ AVX2_FMA_mandelbrot(float Re_min, float Re_max,
     __m256i vec_one = _mm256_set1_epi32(-1);
 
     // 2. Cim
-    __m256 Cim = _mm256_set1_ps(Im_min);
+    __m256 Cim = _mm256_set1_ps(band_im(Im_min, dIm, y0));
 
     // 3. Re advance every x iteration
     __m256 vec_dRe = _mm256_set1_ps(8 * dRe);
@@ -113,11 +296,13 @@ AVX2_FMA_mandelbrot(float Re_min, float Re_max,
     // 4. Im advance every y iteration
     __m256 vec_dIm = _mm256_set1_ps(dIm);
 
-    __m256i itercount, itershuffle;
+    __m256i itercount;
     __m256 Xre2, Xim2, cmp, Xrm, Xre_s, Xim_s, Xre, Xim, Xtt, Cre;
 
     // calculations
-    for (y = 0; y < height; y++) {
+    for (y = 0; y < rows; y++) {
+        if (render_cancelled())
+            break;
 
         Xtt = _mm256_setr_ps(0 * dRe, 1 * dRe, 2 * dRe, 3 * dRe, 4 * dRe, 5 * dRe, 6 * dRe, 7 * dRe);
         Cre = _mm256_set1_ps(Re_min);
@@ -176,17 +361,8 @@ AVX2_FMA_mandelbrot(float Re_min, float Re_max,
                 }
             }
 
-            itershuffle = _mm256_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13,
-                                           (char) 0xff, (char) 0xff, (char) 0xff, (char) 0xff,
-                                           (char) 0xff, (char) 0xff, (char) 0xff, (char) 0xff,
-                                           16, 17, 20, 21, 24, 25, 28, 29,
-                                           (char) 0xff, (char) 0xff, (char) 0xff, (char) 0xff,
-                                           (char) 0xff, (char) 0xff, (char) 0xff, (char) 0xff);
-
-            itercount = _mm256_shuffle_epi8(itercount, itershuffle);
-
-            *ptr++ = _mm256_extract_epi64(itercount, 0);
-            *ptr++ = _mm256_extract_epi64(itercount, 2);
+            AVX2_store(itercount, ptr, elem);
+            ptr += 8 * ELEM_SIZE(elem);
 
             // advance Cre vector
             Cre = _mm256_add_ps(Cre, vec_dRe);
@@ -194,12 +370,17 @@ AVX2_FMA_mandelbrot(float Re_min, float Re_max,
 
         // advance Cim vector
         Cim = _mm256_add_ps(Cim, vec_dIm);
+        progress_rows(1, (char *) data + (size_t) y * width * ELEM_SIZE(elem), width, elem);
     }
+
+    // order non-temporal stores (ELEM_STREAM)
+    _mm_sfence();
 }
 
 void
 AVX2_FMA_STITCH_mandelbrot(float Re_min, float Re_max,
-                           float Im_min, float Im_max, float threshold, int maxiters, int width, int height, uint16_t * data)
+                           float Im_min, float Im_max, float threshold, int maxiters,
+                           int width, int height, int y0, int rows, int elem, void *data)
 {
     float dRe, dIm;
     int y;
@@ -225,16 +406,18 @@ AVX2_FMA_STITCH_mandelbrot(float Re_min, float Re_max,
 
     // calculations
 #pragma omp parallel for
-    for (y = 0; y < height; y += 2) {
+    for (y = 0; y < rows; y += 2) {
+        if (render_cancelled())
+            continue;
 
-        __m256 Cim0 = _mm256_add_ps(_mm256_set1_ps(Im_min), _mm256_set1_ps(y * dIm));
+        __m256 Cim0 = _mm256_add_ps(_mm256_set1_ps(Im_min), _mm256_set1_ps((y0 + y) * dIm));
         __m256 Cim1 = _mm256_add_ps(Cim0, _mm256_set1_ps(dIm));
 
         __m256 Xtt = _mm256_setr_ps(0 * dRe, 1 * dRe, 2 * dRe, 3 * dRe,
                                     4 * dRe, 5 * dRe, 6 * dRe, 7 * dRe);
 	int x, i, j;
-        uint64_t *ptr0 = (uint64_t *) (data + y * width);
-        uint64_t *ptr1 = (uint64_t *) (data + y * width + width);
+        char *ptr0 = (char *) data + (size_t) y * width * ELEM_SIZE(elem);
+        char *ptr1 = ptr0 + (size_t) width * ELEM_SIZE(elem);
 
         __m256 Cre = _mm256_set1_ps(Re_min);
 
@@ -331,25 +514,619 @@ AVX2_FMA_STITCH_mandelbrot(float Re_min, float Re_max,
 
             }
 
-            __m256i itershuffle = _mm256_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13,
-                                           (char) 0xff, (char) 0xff, (char) 0xff, (char) 0xff,
-                                           (char) 0xff, (char) 0xff, (char) 0xff, (char) 0xff,
-                                           16, 17, 20, 21, 24, 25, 28, 29,
-                                           (char) 0xff, (char) 0xff, (char) 0xff, (char) 0xff,
-                                           (char) 0xff, (char) 0xff, (char) 0xff, (char) 0xff);
+            AVX2_store(itercount0, ptr0, elem);
+            AVX2_store(itercount1, ptr1, elem);
+            ptr0 += 8 * ELEM_SIZE(elem);
+            ptr1 += 8 * ELEM_SIZE(elem);
+
+            // advance Cre vector
+            Cre = _mm256_add_ps(Cre, vec_dRe);
+        }
 
-            itercount0 = _mm256_shuffle_epi8(itercount0, itershuffle);
-            itercount1 = _mm256_shuffle_epi8(itercount1, itershuffle);
+        // order non-temporal stores (ELEM_STREAM) before the openmp barrier
+        _mm_sfence();
+        progress_rows(2, (char *) data + (size_t) y * width * ELEM_SIZE(elem), 2 * (size_t) width, elem);
+    }
+}
 
-            *ptr0++ = _mm256_extract_epi64(itercount0, 0);
-            *ptr0++ = _mm256_extract_epi64(itercount0, 2);
-            *ptr1++ = _mm256_extract_epi64(itercount1, 0);
-            *ptr1++ = _mm256_extract_epi64(itercount1, 2);
+//=== FMA implementation, point lists ====================================
+// same iteration as AVX2_FMA_mandelbrot on 8 arbitrary points at a time,
+// resumed from Zre/Zim/count and stored back; escaped lanes keep the z
+// they escaped with (blend), n is a multiple of 8
+
+void
+AVX2_FMA_mandelbrot_points(float threshold, int iters, int n, const float *Cre_p, const float *Cim_p, float *Zre_p,
+                           float *Zim_p, uint32_t *count)
+{
+    int k, i, j;
+
+    int miniters = iters & ~7;
+
+    // prepare vectors
+    // 1. threshold
+    __m256 vec_threshold = _mm256_set1_ps(threshold);
+    __m256i vec_one = _mm256_set1_epi32(-1);
+
+    __m256i itercount;
+    __m256 cmp, active, Xrm, Xre_s, Xim_s, Xre, Xim, Xtt, Cre, Cim;
+
+    for (k = 0; k < n; k += 8) {
+
+        Cre = _mm256_loadu_ps(Cre_p + k);
+        Cim = _mm256_loadu_ps(Cim_p + k);
+        Xre = _mm256_loadu_ps(Zre_p + k);
+        Xim = _mm256_loadu_ps(Zim_p + k);
+
+        i = 0;
+        while (i < miniters) {
+
+            Xre_s = Xre;
+            Xim_s = Xim;
+
+            for (j = 0; j < 8; j++) {
+
+                Xrm = _mm256_mul_ps(Xre, Xim);
+                Xtt = _mm256_fmsub_ps(Xim, Xim, Cre);
+                Xrm = _mm256_add_ps(Xrm, Xrm);
+                Xim = _mm256_add_ps(Cim, Xrm);
+                Xre = _mm256_fmsub_ps(Xre, Xre, Xtt);
+            }       // for
+
+            cmp = _mm256_mul_ps(Xre, Xre);
+            cmp = _mm256_fmadd_ps(Xim, Xim, cmp);
+            cmp = _mm256_cmp_ps(cmp, vec_threshold, _CMP_LE_OS);
+            if (_mm256_testc_si256((__m256i) cmp, vec_one)) {
+                i += 8;
+                continue;
+            }
+            Xre = Xre_s;
+            Xim = Xim_s;
+            break;
+        }
+        itercount = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *) (count + k)), _mm256_set1_epi32(i));
+
+        active = (__m256) vec_one;
+        while (i++ < iters) {
+            cmp = _mm256_mul_ps(Xre, Xre);
+            cmp = _mm256_fmadd_ps(Xim, Xim, cmp);
+            active = _mm256_and_ps(active, _mm256_cmp_ps(cmp, vec_threshold, _CMP_LE_OS));
+            if (_mm256_testz_si256((__m256i) active, (__m256i) active))
+                break;
+            itercount = _mm256_sub_epi32(itercount, (__m256i) active);
+            Xtt = _mm256_fmsub_ps(Xim, Xim, Cre);
+            Xrm = _mm256_add_ps(Xre, Xre);
+            Xim = _mm256_blendv_ps(Xim, _mm256_fmadd_ps(Xrm, Xim, Cim), active);
+            Xre = _mm256_blendv_ps(Xre, _mm256_fmsub_ps(Xre, Xre, Xtt), active);
+        }
+
+        _mm256_storeu_ps(Zre_p + k, Xre);
+        _mm256_storeu_ps(Zim_p + k, Xim);
+        _mm256_storeu_si256((__m256i *) (count + k), itercount);
+    }
+}
+
+//=== AVX2+FMA implementation, distance estimation =======================
+// AVX2+FMA iterating dz/dc along with z, rows in parallel; escaped lanes
+// freeze z and dz with blends, the estimate itself is taken per lane once
+// all 8 lanes are done
+
+void
+AVX2_FMA_mandelbrot_distance(float Re_min, float Re_max, float Im_min, float Im_max, float threshold, int maxiters,
+                             int width, int height, float *distance)
+{
+    float dRe, dIm;
+    int y;
+
+    int miniters = maxiters & ~7;
+
+    // step on Re and Im axis
+    dRe = (Re_max - Re_min) / width;
+    dIm = (Im_max - Im_min) / height;
+
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (y = 0; y < height; y++) {
+        if (render_cancelled())
+            continue;
+        float __attribute__ ((aligned(32))) Zre_l[8], Zim_l[8], Dre_l[8], Dim_l[8];
+        uint32_t __attribute__ ((aligned(32))) count_l[8];
+        float *ptr = distance + (size_t) y * width;
+        int x, i, j, l;
+
+        // prepare vectors
+        __m256 vec_threshold = _mm256_set1_ps(threshold);
+        __m256i vec_one = _mm256_set1_epi32(-1);
+        __m256 vec_fone = _mm256_set1_ps(1.0f);
+        __m256 vec_dRe = _mm256_set1_ps(8 * dRe);
+        __m256 Cim = _mm256_set1_ps(Im_min + y * dIm);
+        __m256 Cre = _mm256_add_ps(_mm256_set1_ps(Re_min),
+                                   _mm256_setr_ps(0 * dRe, 1 * dRe, 2 * dRe, 3 * dRe, 4 * dRe, 5 * dRe, 6 * dRe,
+                                                  7 * dRe));
+
+        __m256i itercount;
+        __m256 cmp, active, Xrm, Xre_s, Xim_s, Dre_s, Dim_s, Xre, Xim, Xtt, Dre, Dim, Pre, Pim;
+
+        for (x = 0; x < width; x += 8) {
+
+            Xre = Cre;
+            Xim = Cim;
+            Dre = vec_fone;
+            Dim = _mm256_setzero_ps();
+
+            i = 0;
+            while (i < miniters) {
+
+                Xre_s = Xre;
+                Xim_s = Xim;
+                Dre_s = Dre;
+                Dim_s = Dim;
+
+                for (j = 0; j < 8; j++) {
+
+                    // dz = 2 z dz + 1, with the z before this step
+                    Pre = _mm256_fmsub_ps(Xre, Dre, _mm256_mul_ps(Xim, Dim));
+                    Pim = _mm256_fmadd_ps(Xre, Dim, _mm256_mul_ps(Xim, Dre));
+                    Dre = _mm256_fmadd_ps(Pre, _mm256_set1_ps(2.0f), vec_fone);
+                    Dim = _mm256_add_ps(Pim, Pim);
+
+                    Xrm = _mm256_mul_ps(Xre, Xim);
+                    Xtt = _mm256_fmsub_ps(Xim, Xim, Cre);
+                    Xrm = _mm256_add_ps(Xrm, Xrm);
+                    Xim = _mm256_add_ps(Cim, Xrm);
+                    Xre = _mm256_fmsub_ps(Xre, Xre, Xtt);
+                }       // for
+
+                cmp = _mm256_mul_ps(Xre, Xre);
+                cmp = _mm256_fmadd_ps(Xim, Xim, cmp);
+                cmp = _mm256_cmp_ps(cmp, vec_threshold, _CMP_LE_OS);
+                if (_mm256_testc_si256((__m256i) cmp, vec_one)) {
+                    i += 8;
+                    continue;
+                }
+                Xre = Xre_s;
+                Xim = Xim_s;
+                Dre = Dre_s;
+                Dim = Dim_s;
+                break;
+            }
+            itercount = _mm256_set1_epi32(i);
+
+            active = (__m256) vec_one;
+            while (i++ < maxiters) {
+                cmp = _mm256_mul_ps(Xre, Xre);
+                cmp = _mm256_fmadd_ps(Xim, Xim, cmp);
+                active = _mm256_and_ps(active, _mm256_cmp_ps(cmp, vec_threshold, _CMP_LE_OS));
+                if (_mm256_testz_si256((__m256i) active, (__m256i) active))
+                    break;
+                itercount = _mm256_sub_epi32(itercount, (__m256i) active);
+                Pre = _mm256_fmsub_ps(Xre, Dre, _mm256_mul_ps(Xim, Dim));
+                Pim = _mm256_fmadd_ps(Xre, Dim, _mm256_mul_ps(Xim, Dre));
+                Dre = _mm256_blendv_ps(Dre, _mm256_fmadd_ps(Pre, _mm256_set1_ps(2.0f), vec_fone), active);
+                Dim = _mm256_blendv_ps(Dim, _mm256_add_ps(Pim, Pim), active);
+                Xtt = _mm256_fmsub_ps(Xim, Xim, Cre);
+                Xrm = _mm256_add_ps(Xre, Xre);
+                Xim = _mm256_blendv_ps(Xim, _mm256_fmadd_ps(Xrm, Xim, Cim), active);
+                Xre = _mm256_blendv_ps(Xre, _mm256_fmsub_ps(Xre, Xre, Xtt), active);
+            }
+
+            _mm256_store_ps(Zre_l, Xre);
+            _mm256_store_ps(Zim_l, Xim);
+            _mm256_store_ps(Dre_l, Dre);
+            _mm256_store_ps(Dim_l, Dim);
+            _mm256_store_si256((__m256i *) count_l, itercount);
+            for (l = 0; l < 8; l++)
+                ptr[x + l] = count_l[l] < (uint32_t) maxiters
+                    ? distance_estimate(Zre_l[l], Zim_l[l], Dre_l[l], Dim_l[l]) : 0;
 
-            // advance Cre vector
             Cre = _mm256_add_ps(Cre, vec_dRe);
         }
+        progress_rows(1, NULL, 0, 0);
+    }
+}
+
+//=== AVX2+FMA implementation, double point lists =========================
+// AVX2+FMA_mandelbrot_points in double on 4 points at a time, from z = c;
+// n is a multiple of 4
+
+void
+AVX2_FMA_mandelbrot_points_double(float threshold, int iters, int n, const double *Cre_p, const double *Cim_p,
+                                  uint32_t *count)
+{
+    int k, i, j;
+
+    int miniters = iters & ~7;
+
+    // prepare vectors
+    // 1. threshold
+    __m256d vec_threshold = _mm256_set1_pd(threshold);
+    __m256i vec_one = _mm256_set1_epi64x(-1);
+    __m256i even = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+
+    __m256i itercount;
+    __m256d cmp, active, Xrm, Xre_s, Xim_s, Xre, Xim, Xtt, Cre, Cim;
+
+    for (k = 0; k < n; k += 4) {
+
+        Cre = _mm256_loadu_pd(Cre_p + k);
+        Cim = _mm256_loadu_pd(Cim_p + k);
+        Xre = Cre;
+        Xim = Cim;
+
+        i = 0;
+        while (i < miniters) {
+
+            Xre_s = Xre;
+            Xim_s = Xim;
+
+            for (j = 0; j < 8; j++) {
+
+                Xrm = _mm256_mul_pd(Xre, Xim);
+                Xtt = _mm256_fmsub_pd(Xim, Xim, Cre);
+                Xrm = _mm256_add_pd(Xrm, Xrm);
+                Xim = _mm256_add_pd(Cim, Xrm);
+                Xre = _mm256_fmsub_pd(Xre, Xre, Xtt);
+            }       // for
+
+            cmp = _mm256_mul_pd(Xre, Xre);
+            cmp = _mm256_fmadd_pd(Xim, Xim, cmp);
+            cmp = _mm256_cmp_pd(cmp, vec_threshold, _CMP_LE_OS);
+            if (_mm256_testc_si256((__m256i) cmp, vec_one)) {
+                i += 8;
+                continue;
+            }
+            Xre = Xre_s;
+            Xim = Xim_s;
+            break;
+        }
+        itercount = _mm256_set1_epi64x(i);
+
+        active = (__m256d) vec_one;
+        while (i++ < iters) {
+            cmp = _mm256_mul_pd(Xre, Xre);
+            cmp = _mm256_fmadd_pd(Xim, Xim, cmp);
+            active = _mm256_and_pd(active, _mm256_cmp_pd(cmp, vec_threshold, _CMP_LE_OS));
+            if (_mm256_testz_si256((__m256i) active, (__m256i) active))
+                break;
+            itercount = _mm256_sub_epi64(itercount, (__m256i) active);
+            Xtt = _mm256_fmsub_pd(Xim, Xim, Cre);
+            Xrm = _mm256_add_pd(Xre, Xre);
+            Xim = _mm256_fmadd_pd(Xrm, Xim, Cim);
+            Xre = _mm256_fmsub_pd(Xre, Xre, Xtt);
+        }
+
+        // low halves of the 64-bit counts
+        itercount = _mm256_permutevar8x32_epi32(itercount, even);
+        _mm_storeu_si128((__m128i *) (count + k), _mm256_castsi256_si128(itercount));
+    }
+}
+
+//=== AVX2+FMA+STITCH implementation, point queries =======================
+// counts of n arbitrary points (from z = c), 16 at a time as two stitched
+// vectors; the last block loads and stores only its valid lanes, the
+// others hold c = 0, which never escapes the unrolled phase, and are
+// inactive in the tail loop
+
+void
+AVX2_FMA_STITCH_mandelbrot_query(float threshold, int maxiters, int n, const float *Cre_p, const float *Cim_p,
+                                 uint32_t *count)
+{
+    int k, i, j;
+
+    int miniters = maxiters & ~7;
+
+    // prepare vectors
+    // 1. threshold
+    __m256 vec_threshold = _mm256_set1_ps(threshold);
+    __m256i vec_one = _mm256_set1_epi32(-1);
+    __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    __m256i itercount0, itercount1, valid0, valid1, rest;
+    __m256 cmp0, cmp1, active0, active1, Xrm0, Xrm1, Xtt0, Xtt1, Xre_s0, Xre_s1, Xim_s0, Xim_s1;
+    __m256 Xre0, Xre1, Xim0, Xim1, Cre0, Cre1, Cim0, Cim1;
+
+    for (k = 0; k < n; k += 16) {
+
+        rest = _mm256_set1_epi32(n - k);
+        valid0 = _mm256_cmpgt_epi32(rest, lane);
+        valid1 = _mm256_cmpgt_epi32(rest, _mm256_add_epi32(lane, _mm256_set1_epi32(8)));
+        Cre0 = _mm256_maskload_ps(Cre_p + k, valid0);
+        Cim0 = _mm256_maskload_ps(Cim_p + k, valid0);
+        Cre1 = _mm256_maskload_ps(Cre_p + k + 8, valid1);
+        Cim1 = _mm256_maskload_ps(Cim_p + k + 8, valid1);
+        Xre0 = Cre0;
+        Xim0 = Cim0;
+        Xre1 = Cre1;
+        Xim1 = Cim1;
+
+        i = 0;
+        while (i < miniters) {
+
+            Xre_s0 = Xre0;
+            Xre_s1 = Xre1;
+            Xim_s0 = Xim0;
+            Xim_s1 = Xim1;
+
+            for (j = 0; j < 8; j++) {
+
+                Xrm0 = _mm256_mul_ps(Xre0, Xim0);
+                Xrm1 = _mm256_mul_ps(Xre1, Xim1);
+                Xtt0 = _mm256_fmsub_ps(Xim0, Xim0, Cre0);
+                Xtt1 = _mm256_fmsub_ps(Xim1, Xim1, Cre1);
+                Xrm0 = _mm256_add_ps(Xrm0, Xrm0);
+                Xrm1 = _mm256_add_ps(Xrm1, Xrm1);
+                Xim0 = _mm256_add_ps(Cim0, Xrm0);
+                Xim1 = _mm256_add_ps(Cim1, Xrm1);
+                Xre0 = _mm256_fmsub_ps(Xre0, Xre0, Xtt0);
+                Xre1 = _mm256_fmsub_ps(Xre1, Xre1, Xtt1);
+            }       // for
+
+            cmp0 = _mm256_mul_ps(Xre0, Xre0);
+            cmp1 = _mm256_mul_ps(Xre1, Xre1);
+            cmp0 = _mm256_fmadd_ps(Xim0, Xim0, cmp0);
+            cmp1 = _mm256_fmadd_ps(Xim1, Xim1, cmp1);
+            cmp0 = _mm256_cmp_ps(cmp0, vec_threshold, _CMP_LE_OS);
+            cmp1 = _mm256_cmp_ps(cmp1, vec_threshold, _CMP_LE_OS);
+            if (_mm256_testc_si256((__m256i) _mm256_and_ps(cmp0, cmp1), vec_one)) {
+                i += 8;
+                continue;
+            }
+            Xre0 = Xre_s0;
+            Xre1 = Xre_s1;
+            Xim0 = Xim_s0;
+            Xim1 = Xim_s1;
+            break;
+        }
+        itercount0 = _mm256_set1_epi32(i);
+        itercount1 = itercount0;
+
+        active0 = (__m256) valid0;
+        active1 = (__m256) valid1;
+        while (i++ < maxiters) {
+            cmp0 = _mm256_mul_ps(Xre0, Xre0);
+            cmp1 = _mm256_mul_ps(Xre1, Xre1);
+            cmp0 = _mm256_fmadd_ps(Xim0, Xim0, cmp0);
+            cmp1 = _mm256_fmadd_ps(Xim1, Xim1, cmp1);
+            active0 = _mm256_and_ps(active0, _mm256_cmp_ps(cmp0, vec_threshold, _CMP_LE_OS));
+            active1 = _mm256_and_ps(active1, _mm256_cmp_ps(cmp1, vec_threshold, _CMP_LE_OS));
+            if (_mm256_testz_si256((__m256i) _mm256_or_ps(active0, active1), vec_one))
+                break;
+            itercount0 = _mm256_sub_epi32(itercount0, (__m256i) active0);
+            itercount1 = _mm256_sub_epi32(itercount1, (__m256i) active1);
+            Xtt0 = _mm256_fmsub_ps(Xim0, Xim0, Cre0);
+            Xtt1 = _mm256_fmsub_ps(Xim1, Xim1, Cre1);
+            Xrm0 = _mm256_add_ps(Xre0, Xre0);
+            Xrm1 = _mm256_add_ps(Xre1, Xre1);
+            Xim0 = _mm256_fmadd_ps(Xrm0, Xim0, Cim0);
+            Xim1 = _mm256_fmadd_ps(Xrm1, Xim1, Cim1);
+            Xre0 = _mm256_fmsub_ps(Xre0, Xre0, Xtt0);
+            Xre1 = _mm256_fmsub_ps(Xre1, Xre1, Xtt1);
+        }
+
+        _mm256_maskstore_epi32((int *) (count + k), valid0, itercount0);
+        _mm256_maskstore_epi32((int *) (count + k + 8), valid1, itercount1);
+    }
+}
+
+//=== AVX2+FMA implementation, Buddhabrot orbits ==========================
+// FPU_buddhabrot_trace on 8 orbits at a time: the histogram indices of the
+// orbit points are computed in vectors, the increments are scattered by
+// the calling thread, whose histogram is private
+
+void
+AVX2_FMA_buddhabrot_trace(float threshold, int maxiters, int n, const float *Cre_p, const float *Cim_p,
+                          float Re_min, float Im_min, float scale_re, float scale_im, int width, int height,
+                          uint32_t *hist)
+{
+    uint32_t __attribute__ ((aligned(32))) index[8];
+    int k, i, l, plot;
+
+    // prepare vectors
+    __m256 vec_threshold = _mm256_set1_ps(threshold);
+    __m256 vec_Re_min = _mm256_set1_ps(Re_min);
+    __m256 vec_Im_min = _mm256_set1_ps(Im_min);
+    __m256 vec_scale_re = _mm256_set1_ps(scale_re);
+    __m256 vec_scale_im = _mm256_set1_ps(scale_im);
+    __m256 vec_width = _mm256_set1_ps(width);
+    __m256 vec_height = _mm256_set1_ps(height);
+    __m256i vec_iwidth = _mm256_set1_epi32(width);
+    __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    __m256i valid;
+    __m256 cmp, active, inside, fx, fy, Xrm, Xre, Xim, Xtt, Cre, Cim;
+
+    for (k = 0; k < n; k += 8) {
+
+        valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(n - k), lane);
+        Cre = _mm256_maskload_ps(Cre_p + k, valid);
+        Cim = _mm256_maskload_ps(Cim_p + k, valid);
+        Xre = Cre;
+        Xim = Cim;
+
+        active = (__m256) valid;
+        for (i = 0; i < maxiters; i++) {
+            cmp = _mm256_mul_ps(Xre, Xre);
+            cmp = _mm256_fmadd_ps(Xim, Xim, cmp);
+            active = _mm256_and_ps(active, _mm256_cmp_ps(cmp, vec_threshold, _CMP_LE_OS));
+            if (_mm256_testz_si256((__m256i) active, (__m256i) active))
+                break;
+
+            // histogram cell of each lane, in frame lanes only
+            fx = _mm256_mul_ps(_mm256_sub_ps(Xre, vec_Re_min), vec_scale_re);
+            fy = _mm256_mul_ps(_mm256_sub_ps(Xim, vec_Im_min), vec_scale_im);
+            inside = _mm256_and_ps(_mm256_cmp_ps(fx, _mm256_setzero_ps(), _CMP_GE_OS),
+                                   _mm256_cmp_ps(fx, vec_width, _CMP_LT_OS));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(fy, _mm256_setzero_ps(), _CMP_GE_OS));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(fy, vec_height, _CMP_LT_OS));
+            plot = _mm256_movemask_ps(_mm256_and_ps(active, inside));
+            if (plot) {
+                _mm256_store_si256((__m256i *) index,
+                                   _mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvttps_epi32(fy), vec_iwidth),
+                                                    _mm256_cvttps_epi32(fx)));
+                for (; plot; plot &= plot - 1) {
+                    l = __builtin_ctz(plot);
+                    hist[index[l]]++;
+                }
+            }
+
+            Xtt = _mm256_fmsub_ps(Xim, Xim, Cre);
+            Xrm = _mm256_add_ps(Xre, Xre);
+            Xim = _mm256_fmadd_ps(Xrm, Xim, Cim);
+            Xre = _mm256_fmsub_ps(Xre, Xre, Xtt);
+        }
+    }
+}
+
+//=== AVX2+FMA+STITCH implementation, Julia and Multibrot families ========
+// two rows of 8 pixels at a time with the unroll-by-8 and rollback of
+// AVX2_FMA_STITCH_mandelbrot; see FPU_family() for the counts
+
+// z^degree + c for degree 2, 3 or 4
+static inline __attribute__ ((always_inline)) void
+AVX2_FMA_family_step(__m256 *Xre, __m256 *Xim, __m256 Cre, __m256 Cim, const int degree)
+{
+    __m256 x = *Xre, y = *Xim, x2, y2, a, b;
+
+    switch (degree) {
+    case 2:
+        // as AVX2_FMA_mandelbrot
+        a = _mm256_fmsub_ps(y, y, Cre);
+        b = _mm256_mul_ps(x, y);
+        *Xim = _mm256_add_ps(Cim, _mm256_add_ps(b, b));
+        *Xre = _mm256_fmsub_ps(x, x, a);
+        break;
+    case 3:
+        // x (x^2 - 3 y^2), y (3 x^2 - y^2)
+        x2 = _mm256_mul_ps(x, x);
+        y2 = _mm256_mul_ps(y, y);
+        *Xre = _mm256_fmadd_ps(x, _mm256_fnmadd_ps(_mm256_set1_ps(3.0f), y2, x2), Cre);
+        *Xim = _mm256_fmadd_ps(y, _mm256_fmsub_ps(_mm256_set1_ps(3.0f), x2, y2), Cim);
+        break;
+    default:
+        // 4, z^2 = a + ib squared
+        a = _mm256_fmsub_ps(x, x, _mm256_mul_ps(y, y));
+        b = _mm256_mul_ps(x, y);
+        b = _mm256_add_ps(b, b);
+        *Xre = _mm256_fmsub_ps(a, a, _mm256_fmsub_ps(b, b, Cre));
+        *Xim = _mm256_fmadd_ps(_mm256_add_ps(a, a), b, Cim);
+        break;
+    }
+}
+
+// count from iteration i on, one step at a time; escaped lanes stop counting
+static inline __attribute__ ((always_inline)) __m256i
+AVX2_FMA_family_tail(__m256 Xre, __m256 Xim, __m256 Cre, __m256 Cim, __m256 vec_threshold, int i, int maxiters,
+                     const int degree)
+{
+    __m256i itercount = _mm256_set1_epi32(i);
+    __m256 active = (__m256) _mm256_set1_epi32(-1), cmp;
+
+    while (i++ < maxiters) {
+        cmp = _mm256_fmadd_ps(Xim, Xim, _mm256_mul_ps(Xre, Xre));
+        active = _mm256_and_ps(active, _mm256_cmp_ps(cmp, vec_threshold, _CMP_LE_OS));
+        if (_mm256_testz_si256((__m256i) active, (__m256i) active))
+            break;
+        itercount = _mm256_sub_epi32(itercount, (__m256i) active);
+        AVX2_FMA_family_step(&Xre, &Xim, Cre, Cim, degree);
+    }
+    return itercount;
+}
+
+static inline __attribute__ ((always_inline)) void
+AVX2_FMA_family(float Re_min, float Re_max, float Im_min, float Im_max, float threshold, int maxiters, int width,
+                int height, int y0, int rows, int elem, void *data, const int julia, const int degree)
+{
+    float dRe = (Re_max - Re_min) / width;
+    float dIm = (Im_max - Im_min) / height;
+    int miniters = maxiters & ~7;
+    int y;
+
+    _mm256_zeroall();
+
+    __m256 vec_threshold = _mm256_set1_ps(threshold);
+    __m256i vec_one = _mm256_set1_epi32(-1);
+    __m256 vec_dRe = _mm256_set1_ps(8 * dRe);
+    __m256 Jre = _mm256_set1_ps(julia_Cre);
+    __m256 Jim = _mm256_set1_ps(julia_Cim);
+
+#if defined(_OPENMP)
+#pragma omp parallel for
+#endif
+    for (y = 0; y < rows; y += 2) {
+        if (render_cancelled())
+            continue;
+
+        __m256 Pim0 = _mm256_add_ps(_mm256_set1_ps(Im_min), _mm256_set1_ps((y0 + y) * dIm));
+        __m256 Pim1 = _mm256_add_ps(Pim0, _mm256_set1_ps(dIm));
+        __m256 Pre = _mm256_add_ps(_mm256_set1_ps(Re_min),
+                                   _mm256_setr_ps(0 * dRe, 1 * dRe, 2 * dRe, 3 * dRe,
+                                                  4 * dRe, 5 * dRe, 6 * dRe, 7 * dRe));
+        char *ptr0 = (char *) data + (size_t) y * width * ELEM_SIZE(elem);
+        char *ptr1 = ptr0 + (size_t) width * ELEM_SIZE(elem);
+        int x, i, j;
+
+        for (x = 0; x < width; x += 8) {
+
+            __m256 Cre0 = julia ? Jre : Pre, Cim0 = julia ? Jim : Pim0;
+            __m256 Cre1 = julia ? Jre : Pre, Cim1 = julia ? Jim : Pim1;
+            __m256 Xre0 = Pre, Xim0 = Pim0, Xre1 = Pre, Xim1 = Pim1;
+            __m256 Xre_s0, Xre_s1, Xim_s0, Xim_s1, cmp0, cmp1;
+
+            i = 0;
+            while (i < miniters) {
+
+                Xre_s0 = Xre0;
+                Xre_s1 = Xre1;
+                Xim_s0 = Xim0;
+                Xim_s1 = Xim1;
+
+                for (j = 0; j < 8; j++) {
+                    AVX2_FMA_family_step(&Xre0, &Xim0, Cre0, Cim0, degree);
+                    AVX2_FMA_family_step(&Xre1, &Xim1, Cre1, Cim1, degree);
+                }
+
+                cmp0 = _mm256_fmadd_ps(Xim0, Xim0, _mm256_mul_ps(Xre0, Xre0));
+                cmp1 = _mm256_fmadd_ps(Xim1, Xim1, _mm256_mul_ps(Xre1, Xre1));
+                cmp0 = _mm256_cmp_ps(cmp0, vec_threshold, _CMP_LE_OS);
+                cmp1 = _mm256_cmp_ps(cmp1, vec_threshold, _CMP_LE_OS);
+                if (_mm256_testc_si256((__m256i) _mm256_and_ps(cmp0, cmp1), vec_one)) {
+                    i += 8;
+                    continue;
+                }
+                Xre0 = Xre_s0;
+                Xre1 = Xre_s1;
+                Xim0 = Xim_s0;
+                Xim1 = Xim_s1;
+                break;
+            }
+
+            AVX2_store(AVX2_FMA_family_tail(Xre0, Xim0, Cre0, Cim0, vec_threshold, i, maxiters, degree), ptr0, elem);
+            AVX2_store(AVX2_FMA_family_tail(Xre1, Xim1, Cre1, Cim1, vec_threshold, i, maxiters, degree), ptr1, elem);
+            ptr0 += 8 * ELEM_SIZE(elem);
+            ptr1 += 8 * ELEM_SIZE(elem);
+
+            Pre = _mm256_add_ps(Pre, vec_dRe);
+        }
+
+        // order non-temporal stores (ELEM_STREAM) before the openmp barrier
+        _mm_sfence();
+        progress_rows(2, (char *) data + (size_t) y * width * ELEM_SIZE(elem), 2 * (size_t) width, elem);
     }
 }
 
+#define AVX2_FMA_FAMILY(name, julia, degree)                                                                    \
+void                                                                                                            \
+name(float Re_min, float Re_max, float Im_min, float Im_max, float threshold, int maxiters, int width,         \
+     int height, int y0, int rows, int elem, void *data)                                                        \
+{                                                                                                               \
+    AVX2_FMA_family(Re_min, Re_max, Im_min, Im_max, threshold, maxiters, width, height, y0, rows, elem, data,   \
+                    julia, degree);                                                                             \
+}
+
+AVX2_FMA_FAMILY(AVX2_FMA_JULIA_fractal, 1, 2)
+AVX2_FMA_FAMILY(AVX2_FMA_JULIA3_fractal, 1, 3)
+AVX2_FMA_FAMILY(AVX2_FMA_JULIA4_fractal, 1, 4)
+AVX2_FMA_FAMILY(AVX2_FMA_MULTI3_fractal, 0, 3)
+AVX2_FMA_FAMILY(AVX2_FMA_MULTI4_fractal, 0, 4)
+
 #endif
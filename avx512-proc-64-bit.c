@@ -2,14 +2,42 @@
 
 #if defined(AVX512)
 
+// store 16 iteration counts as u8 (saturating), u16 (saturating) or u32
+// ELEM_STREAM uses non-temporal stores, see SSE_store()
+static inline void
+AVX512_store(__m512i itercount, void *ptr, int elem)
+{
+    switch (elem) {
+    case ELEM_U8:
+        _mm_storeu_si128((__m128i *) ptr, _mm512_cvtusepi32_epi8(itercount));
+        break;
+    case ELEM_U8 | ELEM_STREAM:
+        _mm_stream_si128((__m128i *) ptr, _mm512_cvtusepi32_epi8(itercount));
+        break;
+    case ELEM_U16:
+        _mm256_storeu_si256((__m256i *) ptr, _mm512_cvtusepi32_epi16(itercount));
+        break;
+    case ELEM_U16 | ELEM_STREAM:
+        _mm256_stream_si256((__m256i *) ptr, _mm512_cvtusepi32_epi16(itercount));
+        break;
+    case ELEM_U32 | ELEM_STREAM:
+        _mm512_stream_si512(ptr, itercount);
+        break;
+    default:
+        _mm512_storeu_si512(ptr, itercount);
+        break;
+    }
+}
+
 void
 AVX512_mandelbrot(float Re_min, float Re_max,
-                  float Im_min, float Im_max, float threshold, int maxiters, int width, int height, uint16_t * data)
+                  float Im_min, float Im_max, float threshold, int maxiters,
+                  int width, int height, int y0, int rows, int elem, void *data)
 {
     float dRe, dIm;
     int x, y, i;
 
-    __m256i *ptr = (__m256i *) data;
+    char *ptr = data;
 
     _mm256_zeroall();
 
@@ -22,7 +50,7 @@ AVX512_mandelbrot(float Re_min, float Re_max,
     __m512 vec_threshold = _mm512_set1_ps(threshold);
 
     // 2. Cim
-    __m512 Cim = _mm512_set1_ps(Im_min);
+    __m512 Cim = _mm512_set1_ps(band_im(Im_min, dIm, y0));
     __m512 Cre, Xre, Xim, Xre2, Xim2, Xrm, Xtt, cmp;
     __m512i itercount;
 
@@ -33,7 +61,9 @@ AVX512_mandelbrot(float Re_min, float Re_max,
     __m512 vec_dIm = _mm512_set1_ps(dIm);
 
     // calculations
-    for (y = 0; y < height; y++) {
+    for (y = 0; y < rows; y++) {
+        if (render_cancelled())
+            break;
 
         Xtt = _mm512_setr_ps(0 * dRe, 1 * dRe, 2 * dRe, 3 * dRe, 4 * dRe, 5 * dRe, 6 * dRe, 7 * dRe,
                              8 * dRe, 9 * dRe, 10 * dRe, 11 * dRe, 12 * dRe, 13 * dRe, 14 * dRe, 15 * dRe);
@@ -61,7 +91,8 @@ AVX512_mandelbrot(float Re_min, float Re_max,
                 Xrm = _mm512_mul_ps(Xre, Xim);
             }
 
-            *ptr++ = _mm512_cvtepi32_epi16(itercount);
+            AVX512_store(itercount, ptr, elem);
+            ptr += 16 * ELEM_SIZE(elem);
 
             // advance Cre vector
             Cre = _mm512_add_ps(Cre, vec_dRe);
@@ -69,7 +100,11 @@ AVX512_mandelbrot(float Re_min, float Re_max,
 
         // advance Cim vector
         Cim = _mm512_add_ps(Cim, vec_dIm);
+        progress_rows(1, (char *) data + (size_t) y * width * ELEM_SIZE(elem), width, elem);
     }
+
+    // order non-temporal stores (ELEM_STREAM)
+    _mm_sfence();
 }
 
 #if defined(FMA)
@@ -78,12 +113,12 @@ AVX512_mandelbrot(float Re_min, float Re_max,
 
 void
 AVX512_FMA_mandelbrot(float Re_min, float Re_max, float Im_min, float Im_max, float threshold, int maxiters, int width,
-                      int height, uint16_t * data)
+                      int height, int y0, int rows, int elem, void *data)
 {
     float dRe, dIm;
     int x, y, i, j;
 
-    __m256i *ptr = (__m256i *) data;
+    char *ptr = data;
     int miniters = maxiters & ~7;
 
     // step on Re and Im axis
@@ -95,9 +130,10 @@ AVX512_FMA_mandelbrot(float Re_min, float Re_max, float Im_min, float Im_max, fl
     // prepare vectors
     // 1. threshold
     __m512 vec_threshold = _mm512_set1_ps(threshold);
+    __m512i vec_one = _mm512_set1_epi32(1);
 
     // 2. Cim
-    __m512 Cim = _mm512_set1_ps(Im_min);
+    __m512 Cim = _mm512_set1_ps(band_im(Im_min, dIm, y0));
 
     // 3. Re advance every x iteration
     __m512 vec_dRe = _mm512_set1_ps(16 * dRe);
@@ -107,9 +143,12 @@ AVX512_FMA_mandelbrot(float Re_min, float Re_max, float Im_min, float Im_max, fl
 
     __m512i itercount;
     __m512 Xre2, Xim2, cmp, Xrm, Xre_s, Xim_s, Xre, Xim, Xtt, Cre;
+    __mmask16 active;
 
     // calculations
-    for (y = 0; y < height; y++) {
+    for (y = 0; y < rows; y++) {
+        if (render_cancelled())
+            break;
 
         Xtt = _mm512_setr_ps(0 * dRe, 1 * dRe, 2 * dRe, 3 * dRe, 4 * dRe, 5 * dRe, 6 * dRe, 7 * dRe,
                              8 * dRe, 9 * dRe, 10 * dRe, 11 * dRe, 12 * dRe, 13 * dRe, 14 * dRe, 15 * dRe);
@@ -138,8 +177,8 @@ AVX512_FMA_mandelbrot(float Re_min, float Re_max, float Im_min, float Im_max, fl
 
                 cmp = _mm512_mul_ps(Xre, Xre);
                 cmp = _mm512_fmadd_ps(Xim, Xim, cmp);
-                cmp = _mm512_cmple_ps(cmp, vec_threshold);
-                if (_mm512_test_all_one((__m512i) cmp)) {
+                active = _mm512_cmp_ps_mask(cmp, vec_threshold, _CMP_LE_OS);
+                if (_mm512_kortestc(active, active)) {
                     i += 8;
                     continue;
                 }
@@ -157,19 +196,20 @@ AVX512_FMA_mandelbrot(float Re_min, float Re_max, float Im_min, float Im_max, fl
                 while (i++ < maxiters) {
                     cmp = _mm512_add_ps(Xre2, Xim2);
                     Xre = _mm512_add_ps(Cre, _mm512_sub_ps(Xre2, Xim2));
-                    cmp = _mm512_cmple_ps(cmp, vec_threshold);
+                    active = _mm512_cmp_ps_mask(cmp, vec_threshold, _CMP_LE_OS);
                     Xim = _mm512_add_ps(Cim, _mm512_add_ps(Xrm, Xrm));
-                    // sqr_dist < threshold => 8 elements vector
-                    if (_mm512_test_all_zero((__m512i) cmp))
+                    // no lane left below the threshold
+                    if (_mm512_kortestz(active, active))
                         break;
-                    itercount = _mm512_sub_epi32(itercount, (__m512i) cmp);
+                    itercount = _mm512_mask_add_epi32(itercount, active, itercount, vec_one);
                     Xre2 = _mm512_mul_ps(Xre, Xre);
                     Xim2 = _mm512_mul_ps(Xim, Xim);
                     Xrm = _mm512_mul_ps(Xre, Xim);
                 }
             }
 
-            *ptr++ = _mm512_cvtepi32_epi16(itercount);
+            AVX512_store(itercount, ptr, elem);
+            ptr += 16 * ELEM_SIZE(elem);
 
             // advance Cre vector
             Cre = _mm512_add_ps(Cre, vec_dRe);
@@ -177,17 +217,22 @@ AVX512_FMA_mandelbrot(float Re_min, float Re_max, float Im_min, float Im_max, fl
 
         // advance Cim vector
         Cim = _mm512_add_ps(Cim, vec_dIm);
+        progress_rows(1, (char *) data + (size_t) y * width * ELEM_SIZE(elem), width, elem);
     }
+
+    // order non-temporal stores (ELEM_STREAM)
+    _mm_sfence();
 }
 
 void
 AVX512_FMA_STITCH_mandelbrot(float Re_min, float Re_max,
-                             float Im_min, float Im_max, float threshold, int maxiters, int width, int height, uint16_t * data)
+                             float Im_min, float Im_max, float threshold, int maxiters,
+                             int width, int height, int y0, int rows, int elem, void *data)
 {
     float dRe, dIm;
     int y;
 
-    __m256i *ptr = (__m256i *) data;
+    char *ptr = data;
     int miniters = maxiters & ~7;
 
     _mm256_zeroall();
@@ -199,6 +244,7 @@ AVX512_FMA_STITCH_mandelbrot(float Re_min, float Re_max,
     // prepare vectors
     // 1. threshold
     __m512 vec_threshold = _mm512_set1_ps(threshold);
+    __m512i vec_one = _mm512_set1_epi32(1);
 
     // 3. Re advance every x iteration
     __m512 vec_dRe = _mm512_set1_ps(16 * dRe);
@@ -208,15 +254,17 @@ AVX512_FMA_STITCH_mandelbrot(float Re_min, float Re_max,
 
     // calculations
 #pragma omp parallel for
-    for (y = 0; y < height; y += 2) {
+    for (y = 0; y < rows; y += 2) {
+        if (render_cancelled())
+            continue;
 
-        __m512 Cim0 = _mm512_add_ps(_mm512_set1_ps(Im_min), _mm512_set1_ps(y * dIm));
+        __m512 Cim0 = _mm512_add_ps(_mm512_set1_ps(Im_min), _mm512_set1_ps((y0 + y) * dIm));
         __m512 Cim1 = _mm512_add_ps(Cim0, _mm512_set1_ps(dIm));
         __m512 Xtt = _mm512_setr_ps(0 * dRe, 1 * dRe, 2 * dRe, 3 * dRe, 4 * dRe, 5 * dRe, 6 * dRe, 7 * dRe,
                                     8 * dRe, 9 * dRe, 10 * dRe, 11 * dRe, 12 * dRe, 13 * dRe, 14 * dRe, 15 * dRe);
 	int x, i, j;
-        __m256i *ptr0 = ptr + y * width / 32;
-        __m256i *ptr1 = ptr0 + width / 32;
+        char *ptr0 = ptr + (size_t) y * width * ELEM_SIZE(elem);
+        char *ptr1 = ptr0 + (size_t) width * ELEM_SIZE(elem);
 
         __m512 Cre = _mm512_set1_ps(Re_min);
 
@@ -227,6 +275,7 @@ AVX512_FMA_STITCH_mandelbrot(float Re_min, float Re_max,
             __m512i itercount0, itercount1;
             __m512 cmp0, cmp1, Xrm0, Xrm1, Xtt0, Xtt1;
             __m512 Xre_s0, Xre_s1, Xim_s0, Xim_s1;
+            __mmask16 active0, active1;
             __m512 Xre0 = Cre;
             __m512 Xim0 = Cim0;
             __m512 Xre1 = Cre;
@@ -258,9 +307,10 @@ AVX512_FMA_STITCH_mandelbrot(float Re_min, float Re_max,
                 cmp1 = _mm512_mul_ps(Xre1, Xre1);
                 cmp0 = _mm512_fmadd_ps(Xim0, Xim0, cmp0);
                 cmp1 = _mm512_fmadd_ps(Xim1, Xim1, cmp1);
-                cmp0 = _mm512_cmple_ps(cmp0, vec_threshold);
-                cmp1 = _mm512_cmple_ps(cmp1, vec_threshold);
-                if (_mm512_test_all_one(_mm512_and_si512((__m512i) cmp0, (__m512i) cmp1))) {
+                active0 = _mm512_cmp_ps_mask(cmp0, vec_threshold, _CMP_LE_OS);
+                active1 = _mm512_cmp_ps_mask(cmp1, vec_threshold, _CMP_LE_OS);
+                active0 = _mm512_kand(active0, active1);
+                if (_mm512_kortestc(active0, active0)) {
                     i += 8;
                     continue;
                 }
@@ -282,12 +332,12 @@ AVX512_FMA_STITCH_mandelbrot(float Re_min, float Re_max,
                 while (j++ < maxiters) {
                     cmp0 = _mm512_add_ps(Xre2, Xim2);
                     Xre0 = _mm512_add_ps(Cre, _mm512_sub_ps(Xre2, Xim2));
-                    cmp0 = _mm512_cmple_ps(cmp0, vec_threshold);
+                    active0 = _mm512_cmp_ps_mask(cmp0, vec_threshold, _CMP_LE_OS);
                     Xim0 = _mm512_add_ps(Cim0, _mm512_add_ps(Xrm, Xrm));
-                    // sqr_dist < threshold => 8 elements vector
-                    if (_mm512_test_all_zero((__m512i) cmp0))
+                    // no lane left below the threshold
+                    if (_mm512_kortestz(active0, active0))
                         break;
-                    itercount0 = _mm512_sub_epi32(itercount0, (__m512i) cmp0);
+                    itercount0 = _mm512_mask_add_epi32(itercount0, active0, itercount0, vec_one);
                     Xre2 = _mm512_mul_ps(Xre0, Xre0);
                     Xim2 = _mm512_mul_ps(Xim0, Xim0);
                     Xrm = _mm512_mul_ps(Xre0, Xim0);
@@ -300,12 +350,12 @@ AVX512_FMA_STITCH_mandelbrot(float Re_min, float Re_max,
                 while (j++ < maxiters) {
                     cmp1 = _mm512_add_ps(Xre2, Xim2);
                     Xre1 = _mm512_add_ps(Cre, _mm512_sub_ps(Xre2, Xim2));
-                    cmp1 = _mm512_cmple_ps(cmp1, vec_threshold);
+                    active1 = _mm512_cmp_ps_mask(cmp1, vec_threshold, _CMP_LE_OS);
                     Xim1 = _mm512_add_ps(Cim1, _mm512_add_ps(Xrm, Xrm));
-                    // sqr_dist < threshold => 8 elements vector
-                    if (_mm512_test_all_zero((__m512i) cmp1))
+                    // no lane left below the threshold
+                    if (_mm512_kortestz(active1, active1))
                         break;
-                    itercount1 = _mm512_sub_epi32(itercount1, (__m512i) cmp1);
+                    itercount1 = _mm512_mask_add_epi32(itercount1, active1, itercount1, vec_one);
                     Xre2 = _mm512_mul_ps(Xre1, Xre1);
                     Xim2 = _mm512_mul_ps(Xim1, Xim1);
                     Xrm = _mm512_mul_ps(Xre1, Xim1);
@@ -313,14 +363,883 @@ AVX512_FMA_STITCH_mandelbrot(float Re_min, float Re_max,
 
             }
 
-            *ptr0++ = _mm512_cvtepi32_epi16(itercount0);
-            *ptr1++ = _mm512_cvtepi32_epi16(itercount1);
+            AVX512_store(itercount0, ptr0, elem);
+            AVX512_store(itercount1, ptr1, elem);
+            ptr0 += 16 * ELEM_SIZE(elem);
+            ptr1 += 16 * ELEM_SIZE(elem);
+
+            // advance Cre vector
+            Cre = _mm512_add_ps(Cre, vec_dRe);
+        }
+
+        // order non-temporal stores (ELEM_STREAM) before the openmp barrier
+        _mm_sfence();
+        progress_rows(2, (char *) data + (size_t) y * width * ELEM_SIZE(elem), 2 * (size_t) width, elem);
+    }
+}
+
+//=== AVX512 opmask implementation - 64-bit code ==========================
+//
+// compare results stay in opmask registers : kortest for loop exits,
+// masked adds to count iterations and to update z, so that escaped lanes
+// keep their last value and stop updating. The arithmetic is the one of
+// the FMA kernels, so the counts are the same.
+
+void
+AVX512_FMA_MASK_mandelbrot(float Re_min, float Re_max, float Im_min, float Im_max, float threshold, int maxiters,
+                           int width, int height, int y0, int rows, int elem, void *data)
+{
+    float dRe, dIm;
+    int x, y, i, j;
+
+    char *ptr = data;
+    int miniters = maxiters & ~7;
+
+    _mm256_zeroall();
+
+    // step on Re and Im axis
+    dRe = (Re_max - Re_min) / width;
+    dIm = (Im_max - Im_min) / height;
+
+    // prepare vectors
+    // 1. threshold
+    __m512 vec_threshold = _mm512_set1_ps(threshold);
+    __m512i vec_one = _mm512_set1_epi32(1);
+
+    // 2. Cim
+    __m512 Cim = _mm512_set1_ps(band_im(Im_min, dIm, y0));
+
+    // 3. Re advance every x iteration
+    __m512 vec_dRe = _mm512_set1_ps(16 * dRe);
+
+    // 4. Im advance every y iteration
+    __m512 vec_dIm = _mm512_set1_ps(dIm);
+
+    __m512i itercount;
+    __m512 Xre2, Xim2, cmp, Xrm, Xre_s, Xim_s, Xre, Xim, Xtt, Cre;
+    __mmask16 active;
+
+    // calculations
+    for (y = 0; y < rows; y++) {
+        if (render_cancelled())
+            break;
+
+        Xtt = _mm512_setr_ps(0 * dRe, 1 * dRe, 2 * dRe, 3 * dRe, 4 * dRe, 5 * dRe, 6 * dRe, 7 * dRe,
+                             8 * dRe, 9 * dRe, 10 * dRe, 11 * dRe, 12 * dRe, 13 * dRe, 14 * dRe, 15 * dRe);
+        Cre = _mm512_set1_ps(Re_min);
+        Cre = _mm512_add_ps(Cre, Xtt);
+
+        for (x = 0; x < width; x += 16) {
+
+            Xre = Cre;
+            Xim = Cim;
+
+            i = 0;
+            while (i < miniters) {
+
+                Xre_s = Xre;
+                Xim_s = Xim;
+
+                for (j = 0; j < 8; j++) {
+
+                    Xrm = _mm512_mul_ps(Xre, Xim);
+                    Xtt = _mm512_fmsub_ps(Xim, Xim, Cre);
+                    Xrm = _mm512_add_ps(Xrm, Xrm);
+                    Xim = _mm512_add_ps(Cim, Xrm);
+                    Xre = _mm512_fmsub_ps(Xre, Xre, Xtt);
+                }       // for
+
+                cmp = _mm512_mul_ps(Xre, Xre);
+                cmp = _mm512_fmadd_ps(Xim, Xim, cmp);
+                active = _mm512_cmp_ps_mask(cmp, vec_threshold, _CMP_LE_OS);
+                if (_mm512_kortestc(active, active)) {
+                    i += 8;
+                    continue;
+                }
+                Xre = Xre_s;
+                Xim = Xim_s;
+                break;
+            }
+            itercount = _mm512_set1_epi32(i);
+
+            // same operations as AVX512_FMA_mandelbrot, escaped lanes frozen
+            Xre2 = _mm512_mul_ps(Xre, Xre);
+            Xim2 = _mm512_mul_ps(Xim, Xim);
+            Xrm = _mm512_mul_ps(Xre, Xim);
+            active = 0xffff;
+            while (i++ < maxiters) {
+                cmp = _mm512_add_ps(Xre2, Xim2);
+                active = _mm512_mask_cmp_ps_mask(active, cmp, vec_threshold, _CMP_LE_OS);
+                if (_mm512_kortestz(active, active))
+                    break;
+                itercount = _mm512_mask_add_epi32(itercount, active, itercount, vec_one);
+                Xre = _mm512_mask_mov_ps(Xre, active, _mm512_add_ps(Cre, _mm512_sub_ps(Xre2, Xim2)));
+                Xim = _mm512_mask_mov_ps(Xim, active, _mm512_add_ps(Cim, _mm512_add_ps(Xrm, Xrm)));
+                Xre2 = _mm512_mul_ps(Xre, Xre);
+                Xim2 = _mm512_mul_ps(Xim, Xim);
+                Xrm = _mm512_mul_ps(Xre, Xim);
+            }
+
+            AVX512_store(itercount, ptr, elem);
+            ptr += 16 * ELEM_SIZE(elem);
+
+            // advance Cre vector
+            Cre = _mm512_add_ps(Cre, vec_dRe);
+        }
+
+        // advance Cim vector
+        Cim = _mm512_add_ps(Cim, vec_dIm);
+        progress_rows(1, (char *) data + (size_t) y * width * ELEM_SIZE(elem), width, elem);
+    }
+
+    // order non-temporal stores (ELEM_STREAM)
+    _mm_sfence();
+}
+
+void
+AVX512_FMA_MASK_STITCH_mandelbrot(float Re_min, float Re_max, float Im_min, float Im_max, float threshold,
+                                  int maxiters, int width, int height, int y0, int rows, int elem, void *data)
+{
+    float dRe, dIm;
+    int y;
+
+    char *ptr = data;
+    int miniters = maxiters & ~7;
+
+    _mm256_zeroall();
+
+    // step on Re and Im axis
+    dRe = (Re_max - Re_min) / width;
+    dIm = (Im_max - Im_min) / height;
+
+    // prepare vectors
+    // 1. threshold
+    __m512 vec_threshold = _mm512_set1_ps(threshold);
+    __m512i vec_one = _mm512_set1_epi32(1);
+
+    // 3. Re advance every x iteration
+    __m512 vec_dRe = _mm512_set1_ps(16 * dRe);
+
+    // calculations
+#if defined(_OPENMP)
+#pragma omp parallel for
+#endif
+    for (y = 0; y < rows; y += 2) {
+        if (render_cancelled())
+            continue;
+
+        __m512 Cim0 = _mm512_add_ps(_mm512_set1_ps(Im_min), _mm512_set1_ps((y0 + y) * dIm));
+        __m512 Cim1 = _mm512_add_ps(Cim0, _mm512_set1_ps(dIm));
+        __m512 Xtt = _mm512_setr_ps(0 * dRe, 1 * dRe, 2 * dRe, 3 * dRe, 4 * dRe, 5 * dRe, 6 * dRe, 7 * dRe,
+                                    8 * dRe, 9 * dRe, 10 * dRe, 11 * dRe, 12 * dRe, 13 * dRe, 14 * dRe, 15 * dRe);
+        int x, i, j;
+        char *ptr0 = ptr + (size_t) y * width * ELEM_SIZE(elem);
+        char *ptr1 = ptr0 + (size_t) width * ELEM_SIZE(elem);
+
+        __m512 Cre = _mm512_set1_ps(Re_min);
+
+        Cre = _mm512_add_ps(Cre, Xtt);
+
+        for (x = 0; x < width; x += 16) {
+
+            __m512i itercount0, itercount1;
+            __m512 cmp0, cmp1, Xrm0, Xrm1, Xtt0, Xtt1, Xre20, Xre21, Xim20, Xim21;
+            __m512 Xre_s0, Xre_s1, Xim_s0, Xim_s1;
+            __m512 Xre0 = Cre;
+            __m512 Xim0 = Cim0;
+            __m512 Xre1 = Cre;
+            __m512 Xim1 = Cim1;
+            __mmask16 active0, active1;
+
+            i = 0;
+            while (i < miniters) {
+
+                Xre_s0 = Xre0;
+                Xre_s1 = Xre1;
+                Xim_s0 = Xim0;
+                Xim_s1 = Xim1;
+
+                for (j = 0; j < 8; j++) {
+
+                    Xrm0 = _mm512_mul_ps(Xre0, Xim0);
+                    Xrm1 = _mm512_mul_ps(Xre1, Xim1);
+                    Xtt0 = _mm512_fmsub_ps(Xim0, Xim0, Cre);
+                    Xtt1 = _mm512_fmsub_ps(Xim1, Xim1, Cre);
+                    Xrm0 = _mm512_add_ps(Xrm0, Xrm0);
+                    Xrm1 = _mm512_add_ps(Xrm1, Xrm1);
+                    Xim0 = _mm512_add_ps(Cim0, Xrm0);
+                    Xim1 = _mm512_add_ps(Cim1, Xrm1);
+                    Xre0 = _mm512_fmsub_ps(Xre0, Xre0, Xtt0);
+                    Xre1 = _mm512_fmsub_ps(Xre1, Xre1, Xtt1);
+                }       // for
+
+                cmp0 = _mm512_mul_ps(Xre0, Xre0);
+                cmp1 = _mm512_mul_ps(Xre1, Xre1);
+                cmp0 = _mm512_fmadd_ps(Xim0, Xim0, cmp0);
+                cmp1 = _mm512_fmadd_ps(Xim1, Xim1, cmp1);
+                active0 = _mm512_cmp_ps_mask(cmp0, vec_threshold, _CMP_LE_OS);
+                active1 = _mm512_cmp_ps_mask(cmp1, vec_threshold, _CMP_LE_OS);
+                active0 = _mm512_kand(active0, active1);
+                if (_mm512_kortestc(active0, active0)) {
+                    i += 8;
+                    continue;
+                }
+                Xre0 = Xre_s0;
+                Xre1 = Xre_s1;
+                Xim0 = Xim_s0;
+                Xim1 = Xim_s1;
+                break;
+            }
+            itercount0 = _mm512_set1_epi32(i);
+            itercount1 = itercount0;
+
+            // both strands run together, each one under its own mask
+            // same operations as AVX512_FMA_STITCH_mandelbrot, escaped lanes frozen
+            Xre20 = _mm512_mul_ps(Xre0, Xre0);
+            Xre21 = _mm512_mul_ps(Xre1, Xre1);
+            Xim20 = _mm512_mul_ps(Xim0, Xim0);
+            Xim21 = _mm512_mul_ps(Xim1, Xim1);
+            Xrm0 = _mm512_mul_ps(Xre0, Xim0);
+            Xrm1 = _mm512_mul_ps(Xre1, Xim1);
+            active0 = 0xffff;
+            active1 = 0xffff;
+            while (i++ < maxiters) {
+                cmp0 = _mm512_add_ps(Xre20, Xim20);
+                cmp1 = _mm512_add_ps(Xre21, Xim21);
+                active0 = _mm512_mask_cmp_ps_mask(active0, cmp0, vec_threshold, _CMP_LE_OS);
+                active1 = _mm512_mask_cmp_ps_mask(active1, cmp1, vec_threshold, _CMP_LE_OS);
+                if (_mm512_kortestz(active0, active1))
+                    break;
+                itercount0 = _mm512_mask_add_epi32(itercount0, active0, itercount0, vec_one);
+                itercount1 = _mm512_mask_add_epi32(itercount1, active1, itercount1, vec_one);
+                Xre0 = _mm512_mask_mov_ps(Xre0, active0, _mm512_add_ps(Cre, _mm512_sub_ps(Xre20, Xim20)));
+                Xre1 = _mm512_mask_mov_ps(Xre1, active1, _mm512_add_ps(Cre, _mm512_sub_ps(Xre21, Xim21)));
+                Xim0 = _mm512_mask_mov_ps(Xim0, active0, _mm512_add_ps(Cim0, _mm512_add_ps(Xrm0, Xrm0)));
+                Xim1 = _mm512_mask_mov_ps(Xim1, active1, _mm512_add_ps(Cim1, _mm512_add_ps(Xrm1, Xrm1)));
+                Xre20 = _mm512_mul_ps(Xre0, Xre0);
+                Xre21 = _mm512_mul_ps(Xre1, Xre1);
+                Xim20 = _mm512_mul_ps(Xim0, Xim0);
+                Xim21 = _mm512_mul_ps(Xim1, Xim1);
+                Xrm0 = _mm512_mul_ps(Xre0, Xim0);
+                Xrm1 = _mm512_mul_ps(Xre1, Xim1);
+            }
+
+            AVX512_store(itercount0, ptr0, elem);
+            AVX512_store(itercount1, ptr1, elem);
+            ptr0 += 16 * ELEM_SIZE(elem);
+            ptr1 += 16 * ELEM_SIZE(elem);
 
             // advance Cre vector
             Cre = _mm512_add_ps(Cre, vec_dRe);
         }
+
+        // order non-temporal stores (ELEM_STREAM) before the openmp barrier
+        _mm_sfence();
+        progress_rows(2, (char *) data + (size_t) y * width * ELEM_SIZE(elem), 2 * (size_t) width, elem);
+    }
+}
+
+//=== AVX512 opmask implementation, point lists ===========================
+// same iteration as AVX512_FMA_MASK_mandelbrot on 16 arbitrary points at a
+// time, resumed from Zre/Zim/count and stored back; escaped lanes keep the
+// z they escaped with, n is a multiple of 16
+
+void
+AVX512_FMA_mandelbrot_points(float threshold, int iters, int n, const float *Cre_p, const float *Cim_p, float *Zre_p,
+                             float *Zim_p, uint32_t *count)
+{
+    int k, i, j;
+
+    int miniters = iters & ~7;
+
+    // prepare vectors
+    // 1. threshold
+    __m512 vec_threshold = _mm512_set1_ps(threshold);
+    __m512i vec_one = _mm512_set1_epi32(1);
+
+    __m512i itercount;
+    __m512 cmp, Xrm, Xre_s, Xim_s, Xre, Xim, Xtt, Cre, Cim;
+    __mmask16 active;
+
+    for (k = 0; k < n; k += 16) {
+
+        Cre = _mm512_loadu_ps(Cre_p + k);
+        Cim = _mm512_loadu_ps(Cim_p + k);
+        Xre = _mm512_loadu_ps(Zre_p + k);
+        Xim = _mm512_loadu_ps(Zim_p + k);
+
+        i = 0;
+        while (i < miniters) {
+
+            Xre_s = Xre;
+            Xim_s = Xim;
+
+            for (j = 0; j < 8; j++) {
+
+                Xrm = _mm512_mul_ps(Xre, Xim);
+                Xtt = _mm512_fmsub_ps(Xim, Xim, Cre);
+                Xrm = _mm512_add_ps(Xrm, Xrm);
+                Xim = _mm512_add_ps(Cim, Xrm);
+                Xre = _mm512_fmsub_ps(Xre, Xre, Xtt);
+            }       // for
+
+            cmp = _mm512_mul_ps(Xre, Xre);
+            cmp = _mm512_fmadd_ps(Xim, Xim, cmp);
+            active = _mm512_cmp_ps_mask(cmp, vec_threshold, _CMP_LE_OS);
+            if (_mm512_kortestc(active, active)) {
+                i += 8;
+                continue;
+            }
+            Xre = Xre_s;
+            Xim = Xim_s;
+            break;
+        }
+        itercount = _mm512_add_epi32(_mm512_loadu_si512(count + k), _mm512_set1_epi32(i));
+
+        active = 0xffff;
+        while (i++ < iters) {
+            cmp = _mm512_mul_ps(Xre, Xre);
+            cmp = _mm512_fmadd_ps(Xim, Xim, cmp);
+            active = _mm512_mask_cmp_ps_mask(active, cmp, vec_threshold, _CMP_LE_OS);
+            if (_mm512_kortestz(active, active))
+                break;
+            itercount = _mm512_mask_add_epi32(itercount, active, itercount, vec_one);
+            Xtt = _mm512_fmsub_ps(Xim, Xim, Cre);
+            Xrm = _mm512_add_ps(Xre, Xre);
+            Xre = _mm512_mask_fmsub_ps(Xre, active, Xre, Xtt);
+            Xim = _mm512_mask_fmadd_ps(Xim, active, Xrm, Cim);
+        }
+
+        _mm512_storeu_ps(Zre_p + k, Xre);
+        _mm512_storeu_ps(Zim_p + k, Xim);
+        _mm512_storeu_si512(count + k, itercount);
+    }
+}
+
+//=== AVX512 opmask implementation, distance estimation ==================
+// AVX512_FMA_MASK_mandelbrot iterating dz/dc along with z, rows in
+// parallel; escaped lanes freeze z and dz, the estimate itself is taken
+// per lane once all 16 lanes are done
+
+void
+AVX512_FMA_mandelbrot_distance(float Re_min, float Re_max, float Im_min, float Im_max, float threshold, int maxiters,
+                               int width, int height, float *distance)
+{
+    float dRe, dIm;
+    int y;
+
+    int miniters = maxiters & ~7;
+
+    // step on Re and Im axis
+    dRe = (Re_max - Re_min) / width;
+    dIm = (Im_max - Im_min) / height;
+
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (y = 0; y < height; y++) {
+        if (render_cancelled())
+            continue;
+        float __attribute__ ((aligned(64))) Zre_l[16], Zim_l[16], Dre_l[16], Dim_l[16];
+        uint32_t __attribute__ ((aligned(64))) count_l[16];
+        float *ptr = distance + (size_t) y * width;
+        int x, i, j, l;
+
+        // prepare vectors
+        __m512 vec_threshold = _mm512_set1_ps(threshold);
+        __m512i vec_one = _mm512_set1_epi32(1);
+        __m512 vec_fone = _mm512_set1_ps(1.0f);
+        __m512 vec_dRe = _mm512_set1_ps(16 * dRe);
+        __m512 Cim = _mm512_set1_ps(Im_min + y * dIm);
+        __m512 Cre = _mm512_add_ps(_mm512_set1_ps(Re_min),
+                                   _mm512_setr_ps(0 * dRe, 1 * dRe, 2 * dRe, 3 * dRe, 4 * dRe, 5 * dRe, 6 * dRe,
+                                                  7 * dRe, 8 * dRe, 9 * dRe, 10 * dRe, 11 * dRe, 12 * dRe,
+                                                  13 * dRe, 14 * dRe, 15 * dRe));
+
+        __m512i itercount;
+        __m512 cmp, Xrm, Xre_s, Xim_s, Dre_s, Dim_s, Xre, Xim, Xtt, Dre, Dim, Pre, Pim;
+        __mmask16 active;
+
+        for (x = 0; x < width; x += 16) {
+
+            Xre = Cre;
+            Xim = Cim;
+            Dre = vec_fone;
+            Dim = _mm512_setzero_ps();
+
+            i = 0;
+            while (i < miniters) {
+
+                Xre_s = Xre;
+                Xim_s = Xim;
+                Dre_s = Dre;
+                Dim_s = Dim;
+
+                for (j = 0; j < 8; j++) {
+
+                    // dz = 2 z dz + 1, with the z before this step
+                    Pre = _mm512_fmsub_ps(Xre, Dre, _mm512_mul_ps(Xim, Dim));
+                    Pim = _mm512_fmadd_ps(Xre, Dim, _mm512_mul_ps(Xim, Dre));
+                    Dre = _mm512_fmadd_ps(Pre, _mm512_set1_ps(2.0f), vec_fone);
+                    Dim = _mm512_add_ps(Pim, Pim);
+
+                    Xrm = _mm512_mul_ps(Xre, Xim);
+                    Xtt = _mm512_fmsub_ps(Xim, Xim, Cre);
+                    Xrm = _mm512_add_ps(Xrm, Xrm);
+                    Xim = _mm512_add_ps(Cim, Xrm);
+                    Xre = _mm512_fmsub_ps(Xre, Xre, Xtt);
+                }       // for
+
+                cmp = _mm512_mul_ps(Xre, Xre);
+                cmp = _mm512_fmadd_ps(Xim, Xim, cmp);
+                active = _mm512_cmp_ps_mask(cmp, vec_threshold, _CMP_LE_OS);
+                if (_mm512_kortestc(active, active)) {
+                    i += 8;
+                    continue;
+                }
+                Xre = Xre_s;
+                Xim = Xim_s;
+                Dre = Dre_s;
+                Dim = Dim_s;
+                break;
+            }
+            itercount = _mm512_set1_epi32(i);
+
+            active = 0xffff;
+            while (i++ < maxiters) {
+                cmp = _mm512_mul_ps(Xre, Xre);
+                cmp = _mm512_fmadd_ps(Xim, Xim, cmp);
+                active = _mm512_mask_cmp_ps_mask(active, cmp, vec_threshold, _CMP_LE_OS);
+                if (_mm512_kortestz(active, active))
+                    break;
+                itercount = _mm512_mask_add_epi32(itercount, active, itercount, vec_one);
+                Pre = _mm512_fmsub_ps(Xre, Dre, _mm512_mul_ps(Xim, Dim));
+                Pim = _mm512_fmadd_ps(Xre, Dim, _mm512_mul_ps(Xim, Dre));
+                Dre = _mm512_mask_mov_ps(Dre, active, _mm512_fmadd_ps(Pre, _mm512_set1_ps(2.0f), vec_fone));
+                Dim = _mm512_mask_add_ps(Dim, active, Pim, Pim);
+                Xtt = _mm512_fmsub_ps(Xim, Xim, Cre);
+                Xrm = _mm512_add_ps(Xre, Xre);
+                Xre = _mm512_mask_fmsub_ps(Xre, active, Xre, Xtt);
+                Xim = _mm512_mask_fmadd_ps(Xim, active, Xrm, Cim);
+            }
+
+            _mm512_store_ps(Zre_l, Xre);
+            _mm512_store_ps(Zim_l, Xim);
+            _mm512_store_ps(Dre_l, Dre);
+            _mm512_store_ps(Dim_l, Dim);
+            _mm512_store_si512(count_l, itercount);
+            for (l = 0; l < 16; l++)
+                ptr[x + l] = count_l[l] < (uint32_t) maxiters
+                    ? distance_estimate(Zre_l[l], Zim_l[l], Dre_l[l], Dim_l[l]) : 0;
+
+            Cre = _mm512_add_ps(Cre, vec_dRe);
+        }
+        progress_rows(1, NULL, 0, 0);
+    }
+}
+
+//=== AVX512 opmask implementation, double point lists ====================
+// AVX512_FMA_mandelbrot_points in double on 8 points at a time, from z = c;
+// n is a multiple of 8
+
+void
+AVX512_FMA_mandelbrot_points_double(float threshold, int iters, int n, const double *Cre_p, const double *Cim_p,
+                                    uint32_t *count)
+{
+    int k, i, j;
+
+    int miniters = iters & ~7;
+
+    // prepare vectors
+    // 1. threshold
+    __m512d vec_threshold = _mm512_set1_pd(threshold);
+    __m512i vec_one = _mm512_set1_epi64(1);
+
+    __m512i itercount;
+    __m512d cmp, Xrm, Xre_s, Xim_s, Xre, Xim, Xtt, Cre, Cim;
+    __mmask8 active;
+
+    for (k = 0; k < n; k += 8) {
+
+        Cre = _mm512_loadu_pd(Cre_p + k);
+        Cim = _mm512_loadu_pd(Cim_p + k);
+        Xre = Cre;
+        Xim = Cim;
+
+        i = 0;
+        while (i < miniters) {
+
+            Xre_s = Xre;
+            Xim_s = Xim;
+
+            for (j = 0; j < 8; j++) {
+
+                Xrm = _mm512_mul_pd(Xre, Xim);
+                Xtt = _mm512_fmsub_pd(Xim, Xim, Cre);
+                Xrm = _mm512_add_pd(Xrm, Xrm);
+                Xim = _mm512_add_pd(Cim, Xrm);
+                Xre = _mm512_fmsub_pd(Xre, Xre, Xtt);
+            }       // for
+
+            cmp = _mm512_mul_pd(Xre, Xre);
+            cmp = _mm512_fmadd_pd(Xim, Xim, cmp);
+            active = _mm512_cmp_pd_mask(cmp, vec_threshold, _CMP_LE_OS);
+            if (active == 0xff) {
+                i += 8;
+                continue;
+            }
+            Xre = Xre_s;
+            Xim = Xim_s;
+            break;
+        }
+        itercount = _mm512_set1_epi64(i);
+
+        active = 0xff;
+        while (i++ < iters) {
+            cmp = _mm512_mul_pd(Xre, Xre);
+            cmp = _mm512_fmadd_pd(Xim, Xim, cmp);
+            active = _mm512_mask_cmp_pd_mask(active, cmp, vec_threshold, _CMP_LE_OS);
+            if (!active)
+                break;
+            itercount = _mm512_mask_add_epi64(itercount, active, itercount, vec_one);
+            Xtt = _mm512_fmsub_pd(Xim, Xim, Cre);
+            Xrm = _mm512_add_pd(Xre, Xre);
+            Xre = _mm512_mask_fmsub_pd(Xre, active, Xre, Xtt);
+            Xim = _mm512_mask_fmadd_pd(Xim, active, Xrm, Cim);
+        }
+
+        _mm256_storeu_si256((__m256i *) (count + k), _mm512_cvtepi64_epi32(itercount));
+    }
+}
+
+//=== AVX512+FMA+STITCH implementation, point queries =====================
+// counts of n arbitrary points (from z = c), 32 at a time as two stitched
+// vectors with the opmask tail loop; the last block loads and stores only
+// its valid lanes, the others hold c = 0, which never escapes the unrolled
+// phase, and are inactive in the tail loop
+
+void
+AVX512_FMA_STITCH_mandelbrot_query(float threshold, int maxiters, int n, const float *Cre_p, const float *Cim_p,
+                                   uint32_t *count)
+{
+    int k, i, j;
+
+    int miniters = maxiters & ~7;
+
+    // prepare vectors
+    // 1. threshold
+    __m512 vec_threshold = _mm512_set1_ps(threshold);
+    __m512i vec_one = _mm512_set1_epi32(1);
+
+    __m512i itercount0, itercount1;
+    __m512 cmp0, cmp1, Xrm0, Xrm1, Xtt0, Xtt1, Xre_s0, Xre_s1, Xim_s0, Xim_s1;
+    __m512 Xre0, Xre1, Xim0, Xim1, Cre0, Cre1, Cim0, Cim1;
+    __mmask16 valid0, valid1, active0, active1;
+
+    for (k = 0; k < n; k += 32) {
+
+        valid0 = n - k >= 16 ? 0xffff : (1U << (n - k)) - 1;
+        valid1 = n - k >= 32 ? 0xffff : n - k <= 16 ? 0 : (1U << (n - k - 16)) - 1;
+        Cre0 = _mm512_maskz_loadu_ps(valid0, Cre_p + k);
+        Cim0 = _mm512_maskz_loadu_ps(valid0, Cim_p + k);
+        Cre1 = _mm512_maskz_loadu_ps(valid1, Cre_p + k + 16);
+        Cim1 = _mm512_maskz_loadu_ps(valid1, Cim_p + k + 16);
+        Xre0 = Cre0;
+        Xim0 = Cim0;
+        Xre1 = Cre1;
+        Xim1 = Cim1;
+
+        i = 0;
+        while (i < miniters) {
+
+            Xre_s0 = Xre0;
+            Xre_s1 = Xre1;
+            Xim_s0 = Xim0;
+            Xim_s1 = Xim1;
+
+            for (j = 0; j < 8; j++) {
+
+                Xrm0 = _mm512_mul_ps(Xre0, Xim0);
+                Xrm1 = _mm512_mul_ps(Xre1, Xim1);
+                Xtt0 = _mm512_fmsub_ps(Xim0, Xim0, Cre0);
+                Xtt1 = _mm512_fmsub_ps(Xim1, Xim1, Cre1);
+                Xrm0 = _mm512_add_ps(Xrm0, Xrm0);
+                Xrm1 = _mm512_add_ps(Xrm1, Xrm1);
+                Xim0 = _mm512_add_ps(Cim0, Xrm0);
+                Xim1 = _mm512_add_ps(Cim1, Xrm1);
+                Xre0 = _mm512_fmsub_ps(Xre0, Xre0, Xtt0);
+                Xre1 = _mm512_fmsub_ps(Xre1, Xre1, Xtt1);
+            }       // for
+
+            cmp0 = _mm512_mul_ps(Xre0, Xre0);
+            cmp1 = _mm512_mul_ps(Xre1, Xre1);
+            cmp0 = _mm512_fmadd_ps(Xim0, Xim0, cmp0);
+            cmp1 = _mm512_fmadd_ps(Xim1, Xim1, cmp1);
+            active0 = _mm512_cmp_ps_mask(cmp0, vec_threshold, _CMP_LE_OS);
+            active1 = _mm512_cmp_ps_mask(cmp1, vec_threshold, _CMP_LE_OS);
+            if (_mm512_kortestc(_mm512_kand(active0, active1), _mm512_kand(active0, active1))) {
+                i += 8;
+                continue;
+            }
+            Xre0 = Xre_s0;
+            Xre1 = Xre_s1;
+            Xim0 = Xim_s0;
+            Xim1 = Xim_s1;
+            break;
+        }
+        itercount0 = _mm512_set1_epi32(i);
+        itercount1 = itercount0;
+
+        active0 = valid0;
+        active1 = valid1;
+        while (i++ < maxiters) {
+            cmp0 = _mm512_mul_ps(Xre0, Xre0);
+            cmp1 = _mm512_mul_ps(Xre1, Xre1);
+            cmp0 = _mm512_fmadd_ps(Xim0, Xim0, cmp0);
+            cmp1 = _mm512_fmadd_ps(Xim1, Xim1, cmp1);
+            active0 = _mm512_mask_cmp_ps_mask(active0, cmp0, vec_threshold, _CMP_LE_OS);
+            active1 = _mm512_mask_cmp_ps_mask(active1, cmp1, vec_threshold, _CMP_LE_OS);
+            if (_mm512_kortestz(active0, active1))
+                break;
+            itercount0 = _mm512_mask_add_epi32(itercount0, active0, itercount0, vec_one);
+            itercount1 = _mm512_mask_add_epi32(itercount1, active1, itercount1, vec_one);
+            Xtt0 = _mm512_fmsub_ps(Xim0, Xim0, Cre0);
+            Xtt1 = _mm512_fmsub_ps(Xim1, Xim1, Cre1);
+            Xrm0 = _mm512_add_ps(Xre0, Xre0);
+            Xrm1 = _mm512_add_ps(Xre1, Xre1);
+            Xre0 = _mm512_mask_fmsub_ps(Xre0, active0, Xre0, Xtt0);
+            Xre1 = _mm512_mask_fmsub_ps(Xre1, active1, Xre1, Xtt1);
+            Xim0 = _mm512_mask_fmadd_ps(Xim0, active0, Xrm0, Cim0);
+            Xim1 = _mm512_mask_fmadd_ps(Xim1, active1, Xrm1, Cim1);
+        }
+
+        _mm512_mask_storeu_epi32(count + k, valid0, itercount0);
+        _mm512_mask_storeu_epi32(count + k + 16, valid1, itercount1);
+    }
+}
+
+//=== AVX512 opmask implementation, Buddhabrot orbits =====================
+// FPU_buddhabrot_trace on 16 orbits at a time: the histogram indices of
+// the orbit points are computed in vectors, the increments are scattered
+// by the calling thread, whose histogram is private
+
+void
+AVX512_FMA_buddhabrot_trace(float threshold, int maxiters, int n, const float *Cre_p, const float *Cim_p,
+                            float Re_min, float Im_min, float scale_re, float scale_im, int width, int height,
+                            uint32_t *hist)
+{
+    uint32_t __attribute__ ((aligned(64))) index[16];
+    int k, i, l;
+
+    // prepare vectors
+    __m512 vec_threshold = _mm512_set1_ps(threshold);
+    __m512 vec_Re_min = _mm512_set1_ps(Re_min);
+    __m512 vec_Im_min = _mm512_set1_ps(Im_min);
+    __m512 vec_scale_re = _mm512_set1_ps(scale_re);
+    __m512 vec_scale_im = _mm512_set1_ps(scale_im);
+    __m512 vec_width = _mm512_set1_ps(width);
+    __m512 vec_height = _mm512_set1_ps(height);
+    __m512 vec_zero = _mm512_setzero_ps();
+    __m512i vec_iwidth = _mm512_set1_epi32(width);
+
+    __m512 cmp, fx, fy, Xrm, Xre, Xim, Xtt, Cre, Cim;
+    __mmask16 active, plot;
+
+    for (k = 0; k < n; k += 16) {
+
+        active = n - k >= 16 ? 0xffff : (1U << (n - k)) - 1;
+        Cre = _mm512_maskz_loadu_ps(active, Cre_p + k);
+        Cim = _mm512_maskz_loadu_ps(active, Cim_p + k);
+        Xre = Cre;
+        Xim = Cim;
+
+        for (i = 0; i < maxiters; i++) {
+            cmp = _mm512_mul_ps(Xre, Xre);
+            cmp = _mm512_fmadd_ps(Xim, Xim, cmp);
+            active = _mm512_mask_cmp_ps_mask(active, cmp, vec_threshold, _CMP_LE_OS);
+            if (!active)
+                break;
+
+            // histogram cell of each lane, in frame lanes only
+            fx = _mm512_mul_ps(_mm512_sub_ps(Xre, vec_Re_min), vec_scale_re);
+            fy = _mm512_mul_ps(_mm512_sub_ps(Xim, vec_Im_min), vec_scale_im);
+            plot = _mm512_mask_cmp_ps_mask(active, fx, vec_zero, _CMP_GE_OS);
+            plot = _mm512_mask_cmp_ps_mask(plot, fx, vec_width, _CMP_LT_OS);
+            plot = _mm512_mask_cmp_ps_mask(plot, fy, vec_zero, _CMP_GE_OS);
+            plot = _mm512_mask_cmp_ps_mask(plot, fy, vec_height, _CMP_LT_OS);
+            if (plot) {
+                _mm512_store_si512(index, _mm512_add_epi32(_mm512_mullo_epi32(_mm512_cvttps_epi32(fy), vec_iwidth),
+                                                           _mm512_cvttps_epi32(fx)));
+                for (; plot; plot &= plot - 1) {
+                    l = __builtin_ctz(plot);
+                    hist[index[l]]++;
+                }
+            }
+
+            Xtt = _mm512_fmsub_ps(Xim, Xim, Cre);
+            Xrm = _mm512_add_ps(Xre, Xre);
+            Xre = _mm512_mask_fmsub_ps(Xre, active, Xre, Xtt);
+            Xim = _mm512_mask_fmadd_ps(Xim, active, Xrm, Cim);
+        }
+    }
+}
+
+//=== AVX512+FMA+STITCH implementation, Julia and Multibrot families ======
+// two rows of 16 pixels at a time with the unroll-by-8 and rollback of
+// AVX512_FMA_STITCH_mandelbrot, opmask tail; see FPU_family() for the counts
+
+// z^degree + c for degree 2, 3 or 4
+static inline __attribute__ ((always_inline)) void
+AVX512_FMA_family_step(__m512 *Xre, __m512 *Xim, __m512 Cre, __m512 Cim, const int degree)
+{
+    __m512 x = *Xre, y = *Xim, x2, y2, a, b;
+
+    switch (degree) {
+    case 2:
+        // as AVX512_FMA_mandelbrot
+        a = _mm512_fmsub_ps(y, y, Cre);
+        b = _mm512_mul_ps(x, y);
+        *Xim = _mm512_add_ps(Cim, _mm512_add_ps(b, b));
+        *Xre = _mm512_fmsub_ps(x, x, a);
+        break;
+    case 3:
+        // x (x^2 - 3 y^2), y (3 x^2 - y^2)
+        x2 = _mm512_mul_ps(x, x);
+        y2 = _mm512_mul_ps(y, y);
+        *Xre = _mm512_fmadd_ps(x, _mm512_fnmadd_ps(_mm512_set1_ps(3.0f), y2, x2), Cre);
+        *Xim = _mm512_fmadd_ps(y, _mm512_fmsub_ps(_mm512_set1_ps(3.0f), x2, y2), Cim);
+        break;
+    default:
+        // 4, z^2 = a + ib squared
+        a = _mm512_fmsub_ps(x, x, _mm512_mul_ps(y, y));
+        b = _mm512_mul_ps(x, y);
+        b = _mm512_add_ps(b, b);
+        *Xre = _mm512_fmsub_ps(a, a, _mm512_fmsub_ps(b, b, Cre));
+        *Xim = _mm512_fmadd_ps(_mm512_add_ps(a, a), b, Cim);
+        break;
     }
 }
 
+// count from iteration i on, one step at a time, under the mask of the lanes
+// which have not escaped yet
+static inline __attribute__ ((always_inline)) __m512i
+AVX512_FMA_family_tail(__m512 Xre, __m512 Xim, __m512 Cre, __m512 Cim, __m512 vec_threshold, int i, int maxiters,
+                       const int degree)
+{
+    __m512i itercount = _mm512_set1_epi32(i), vec_one = _mm512_set1_epi32(1);
+    __mmask16 active = 0xffff;
+
+    while (i++ < maxiters) {
+        __m512 cmp = _mm512_fmadd_ps(Xim, Xim, _mm512_mul_ps(Xre, Xre));
+
+        active = _mm512_mask_cmp_ps_mask(active, cmp, vec_threshold, _CMP_LE_OS);
+        if (!active)
+            break;
+        itercount = _mm512_mask_add_epi32(itercount, active, itercount, vec_one);
+        AVX512_FMA_family_step(&Xre, &Xim, Cre, Cim, degree);
+    }
+    return itercount;
+}
+
+static inline __attribute__ ((always_inline)) void
+AVX512_FMA_family(float Re_min, float Re_max, float Im_min, float Im_max, float threshold, int maxiters,
+                  int width, int height, int y0, int rows, int elem, void *data, const int julia, const int degree)
+{
+    float dRe = (Re_max - Re_min) / width;
+    float dIm = (Im_max - Im_min) / height;
+    int miniters = maxiters & ~7;
+    int y;
+
+    _mm256_zeroall();
+
+    __m512 vec_threshold = _mm512_set1_ps(threshold);
+    __m512 vec_dRe = _mm512_set1_ps(16 * dRe);
+    __m512 Jre = _mm512_set1_ps(julia_Cre);
+    __m512 Jim = _mm512_set1_ps(julia_Cim);
+
+#if defined(_OPENMP)
+#pragma omp parallel for
+#endif
+    for (y = 0; y < rows; y += 2) {
+        if (render_cancelled())
+            continue;
+
+        __m512 Pim0 = _mm512_add_ps(_mm512_set1_ps(Im_min), _mm512_set1_ps((y0 + y) * dIm));
+        __m512 Pim1 = _mm512_add_ps(Pim0, _mm512_set1_ps(dIm));
+        __m512 Pre = _mm512_add_ps(_mm512_set1_ps(Re_min),
+                                   _mm512_setr_ps(0 * dRe, 1 * dRe, 2 * dRe, 3 * dRe, 4 * dRe, 5 * dRe, 6 * dRe,
+                                                  7 * dRe, 8 * dRe, 9 * dRe, 10 * dRe, 11 * dRe, 12 * dRe,
+                                                  13 * dRe, 14 * dRe, 15 * dRe));
+        char *ptr0 = (char *) data + (size_t) y * width * ELEM_SIZE(elem);
+        char *ptr1 = ptr0 + (size_t) width * ELEM_SIZE(elem);
+        int x, i, j;
+
+        for (x = 0; x < width; x += 16) {
+
+            __m512 Cre0 = julia ? Jre : Pre, Cim0 = julia ? Jim : Pim0;
+            __m512 Cre1 = julia ? Jre : Pre, Cim1 = julia ? Jim : Pim1;
+            __m512 Xre0 = Pre, Xim0 = Pim0, Xre1 = Pre, Xim1 = Pim1;
+            __m512 Xre_s0, Xre_s1, Xim_s0, Xim_s1, cmp0, cmp1;
+            __mmask16 active;
+
+            i = 0;
+            while (i < miniters) {
+
+                Xre_s0 = Xre0;
+                Xre_s1 = Xre1;
+                Xim_s0 = Xim0;
+                Xim_s1 = Xim1;
+
+                for (j = 0; j < 8; j++) {
+                    AVX512_FMA_family_step(&Xre0, &Xim0, Cre0, Cim0, degree);
+                    AVX512_FMA_family_step(&Xre1, &Xim1, Cre1, Cim1, degree);
+                }
+
+                cmp0 = _mm512_fmadd_ps(Xim0, Xim0, _mm512_mul_ps(Xre0, Xre0));
+                cmp1 = _mm512_fmadd_ps(Xim1, Xim1, _mm512_mul_ps(Xre1, Xre1));
+                active = _mm512_kand(_mm512_cmp_ps_mask(cmp0, vec_threshold, _CMP_LE_OS),
+                                     _mm512_cmp_ps_mask(cmp1, vec_threshold, _CMP_LE_OS));
+                if (_mm512_kortestc(active, active)) {
+                    i += 8;
+                    continue;
+                }
+                Xre0 = Xre_s0;
+                Xre1 = Xre_s1;
+                Xim0 = Xim_s0;
+                Xim1 = Xim_s1;
+                break;
+            }
+
+            AVX512_store(AVX512_FMA_family_tail(Xre0, Xim0, Cre0, Cim0, vec_threshold, i, maxiters, degree), ptr0,
+                         elem);
+            AVX512_store(AVX512_FMA_family_tail(Xre1, Xim1, Cre1, Cim1, vec_threshold, i, maxiters, degree), ptr1,
+                         elem);
+            ptr0 += 16 * ELEM_SIZE(elem);
+            ptr1 += 16 * ELEM_SIZE(elem);
+
+            Pre = _mm512_add_ps(Pre, vec_dRe);
+        }
+
+        // order non-temporal stores (ELEM_STREAM) before the openmp barrier
+        _mm_sfence();
+        progress_rows(2, (char *) data + (size_t) y * width * ELEM_SIZE(elem), 2 * (size_t) width, elem);
+    }
+}
+
+#define AVX512_FMA_FAMILY(name, julia, degree)                                                                  \
+void                                                                                                            \
+name(float Re_min, float Re_max, float Im_min, float Im_max, float threshold, int maxiters, int width,         \
+     int height, int y0, int rows, int elem, void *data)                                                        \
+{                                                                                                               \
+    AVX512_FMA_family(Re_min, Re_max, Im_min, Im_max, threshold, maxiters, width, height, y0, rows, elem, data, \
+                      julia, degree);                                                                           \
+}
+
+AVX512_FMA_FAMILY(AVX512_FMA_JULIA_fractal, 1, 2)
+AVX512_FMA_FAMILY(AVX512_FMA_JULIA3_fractal, 1, 3)
+AVX512_FMA_FAMILY(AVX512_FMA_JULIA4_fractal, 1, 4)
+AVX512_FMA_FAMILY(AVX512_FMA_MULTI3_fractal, 0, 3)
+AVX512_FMA_FAMILY(AVX512_FMA_MULTI4_fractal, 0, 4)
+
 #endif
 #endif
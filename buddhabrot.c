@@ -0,0 +1,178 @@
+//=== Buddhabrot =========================================================
+//
+// -buddhabrot N accumulates the orbits of N random points of [-2, 0.5] x
+// [-1.25, 1.25] into a density histogram over the window.  Batches of
+// BUDDHA_BATCH points first go through mandelbrot_query(); only the points
+// which escape (with -anti, only those which do not) are kept, sorted by
+// count so that the lanes of a vector trace orbits of similar length, and
+// re-traced by the *_buddhabrot_trace kernels.  Each openmp thread adds to
+// its own histogram, without atomics; the histograms are summed in
+// parallel at the end and written as NAME.pgm, grey = sqrt(density).
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+#define BUDDHA_BATCH (1 << 20)  // random points per first pass
+#define BUDDHA_CHUNK 256        // orbits per openmp work item
+
+typedef void (*buddhabrot_trace_fn) (float threshold, int maxiters, int n, const float *Cre, const float *Cim,
+                                     float Re_min, float Im_min, float scale_re, float scale_im, int width,
+                                     int height, uint32_t *hist);
+
+#if defined(AVX512) && defined(FMA)
+static const buddhabrot_trace_fn buddha_function = AVX512_FMA_buddhabrot_trace;
+static const char *buddha_name = "AVX512+FMA";
+#elif defined(AVX2) && defined(FMA)
+static const buddhabrot_trace_fn buddha_function = AVX2_FMA_buddhabrot_trace;
+static const char *buddha_name = "AVX2+FMA";
+#else
+static const buddhabrot_trace_fn buddha_function = FPU_buddhabrot_trace;
+static const char *buddha_name = "FPU";
+#endif
+
+// keep the points to trace, sorted by count (counting sort); returns how many
+static size_t
+buddhabrot_keep(int anti, int maxiters, size_t n, const float *Cre, const float *Cim, const uint32_t *count,
+                float *Kre, float *Kim, size_t *bucket)
+{
+    size_t k, kept = 0, sum = 0, c;
+
+    memset(bucket, 0, (maxiters + 1) * sizeof(*bucket));
+    for (k = 0; k < n; k++)
+        if (anti ? count[k] >= (uint32_t) maxiters : count[k] > 0 && count[k] < (uint32_t) maxiters)
+            bucket[count[k]]++;
+    for (c = 0; c <= (size_t) maxiters; c++) {
+        size_t b = bucket[c];
+
+        bucket[c] = sum;
+        sum += b;
+    }
+    for (k = 0; k < n; k++)
+        if (anti ? count[k] >= (uint32_t) maxiters : count[k] > 0 && count[k] < (uint32_t) maxiters) {
+            size_t at = bucket[count[k]]++;
+
+            Kre[at] = Cre[k];
+            Kim[at] = Cim[k];
+            kept++;
+        }
+    return kept;
+}
+
+void
+buddhabrot_render(const char *name, size_t samples, int anti, float Re_min, float Re_max, float Im_min,
+                  float Im_max, float threshold, int maxiters, int width, int height)
+{
+    const double S_min = -2.0, S_size = 2.5, T_min = -1.25, T_size = 2.5;
+    size_t npix = (size_t) width * height, batch = samples < BUDDHA_BATCH ? samples : BUDDHA_BATCH;
+    size_t done, orbits = 0, pos;
+    float scale_re = width / (Re_max - Re_min), scale_im = height / (Im_max - Im_min);
+    float *Cre = malloc(batch * sizeof(float)), *Cim = malloc(batch * sizeof(float));
+    float *Kre = malloc(batch * sizeof(float)), *Kim = malloc(batch * sizeof(float));
+    uint32_t *count = malloc(batch * sizeof(uint32_t));
+    size_t *bucket = malloc((maxiters + 1) * sizeof(size_t));
+    uint32_t **hist, t1, query_us = 0, trace_us = 0, reduce_us;
+    uint64_t total = 0;
+    uint32_t top = 0;
+    int nthreads = 1, t;
+    char image_name[256];
+    unsigned char *line;
+    FILE *f;
+
+#if defined(_OPENMP)
+    nthreads = omp_get_max_threads();
+#endif
+    hist = malloc(nthreads * sizeof(*hist));
+    if (!Cre || !Cim || !Kre || !Kim || !count || !bucket || !hist)
+        die("buddhabrot: out of memory");
+    for (t = 0; t < nthreads; t++) {
+        hist[t] = calloc(npix, sizeof(uint32_t));
+        if (!hist[t])
+            die("buddhabrot: out of memory");
+    }
+
+    for (done = 0; done < samples; done += batch) {
+        long m = samples - done < batch ? samples - done : batch, k, kept;
+
+#if defined(_OPENMP)
+#pragma omp parallel for
+#endif
+        for (k = 0; k < m; k++) {
+            uint64_t s = (done + k + 1) * 0x9e3779b97f4a7c15ULL;
+            uint64_t r = area_random(&s);
+
+            Cre[k] = S_min + S_size * (double) (r >> 40) / (1 << 24);
+            Cim[k] = T_min + T_size * (double) (r & 0xffffff) / (1 << 24);
+        }
+
+        t1 = get_time();
+        mandelbrot_query(threshold, maxiters, m, Cre, Cim, count);
+        query_us += get_time() - t1;
+
+        kept = buddhabrot_keep(anti, maxiters, m, Cre, Cim, count, Kre, Kim, bucket);
+        orbits += kept;
+
+        t1 = get_time();
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for (k = 0; k < kept; k += BUDDHA_CHUNK) {
+            int len = kept - k < BUDDHA_CHUNK ? kept - k : BUDDHA_CHUNK;
+            int self = 0;
+
+#if defined(_OPENMP)
+            self = omp_get_thread_num();
+#endif
+            buddha_function(threshold, maxiters, len, Kre + k, Kim + k, Re_min, Im_min, scale_re, scale_im, width,
+                            height, hist[self]);
+        }
+        trace_us += get_time() - t1;
+    }
+
+    // sum the private histograms into the first one
+    t1 = get_time();
+#if defined(_OPENMP)
+#pragma omp parallel for reduction(+:total) reduction(max:top)
+#endif
+    for (pos = 0; pos < npix; pos++) {
+        uint32_t sum = hist[0][pos];
+        int i;
+
+        for (i = 1; i < nthreads; i++)
+            sum += hist[i][pos];
+        hist[0][pos] = sum;
+        total += sum;
+        top = sum > top ? sum : top;
+    }
+    reduce_us = get_time() - t1;
+
+    printf("\n  buddhabrot: %zu samples, %zu %s orbits, %llu orbit points, %d histograms\n"
+           "  query %u us (%.1f Mpoints/s), trace %u us with %s (%.0f orbits/s), reduce %u us\n", samples, orbits,
+           anti ? "bounded" : "escaping", (unsigned long long) total, nthreads, query_us,
+           query_us ? (double) samples / query_us : 0.0, trace_us, buddha_name,
+           trace_us ? orbits * 1e6 / trace_us : 0.0, reduce_us);
+
+    sprintf(image_name, "%s.pgm", name);
+    f = fopen(image_name, "wb");
+    line = malloc(width);
+    if (!f || !line)
+        die("cannot write %s", image_name);
+    fprintf(f, "P5\n%d %d\n255\n", width, height);
+    for (pos = 0; pos < npix; pos++) {
+        line[pos % width] = top ? (unsigned char) (255 * sqrt((double) hist[0][pos] / top)) : 0;
+        if (pos % width == (size_t) width - 1)
+            fwrite(line, 1, width, f);
+    }
+    fclose(f);
+
+    for (t = 0; t < nthreads; t++)
+        free(hist[t]);
+    free(hist);
+    free(line);
+    free(Cre);
+    free(Cim);
+    free(Kre);
+    free(Kim);
+    free(count);
+    free(bucket);
+}
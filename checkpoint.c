@@ -0,0 +1,248 @@
+//=== Checkpoint and restart =============================================
+//
+// -checkpoint file renders the frame in strips of -tile rows.  Finished
+// strips are handed to a writer thread, which stores them at their offset
+// in the checkpoint file and, at most every CHECKPOINT_INTERVAL, syncs the
+// data and then sets their bits in the completion bitmap.  The render
+// threads never wait for the disk: strips are written straight from the
+// frame, which is not modified once a strip is done.
+//
+// -resume reloads the strips marked in the bitmap and renders the others.
+//
+// file: struct checkpoint_header, bitmap, padding to CHECKPOINT_ALIGN,
+// then the frame (elem of the run)
+
+#define CHECKPOINT_MAGIC    0x50434d46U     // "FMCP"
+#define CHECKPOINT_ALIGN    4096
+#define CHECKPOINT_INTERVAL 1000000         // us between syncs of the bitmap
+
+struct checkpoint_header {
+    uint32_t magic;
+    uint32_t width, height;
+    float Re_min, Re_max, Im_min, Im_max;
+    float threshold;
+    uint32_t maxiters;
+    uint32_t elem;              // element size, without ELEM_STREAM
+    uint32_t tile_rows;
+    uint32_t ntiles;
+    char procedure[32];
+    float julia_Cre, julia_Cim; // c of the Julia procedures
+};
+
+static struct checkpoint {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int fd;
+    int *queue;                 // finished strips not yet written
+    int queued;
+    int done;                   // no more strips will be queued
+    unsigned char *bitmap;      // as on disk, bits set once the strip data is synced
+    size_t bitmap_len;
+    off_t data_offset;
+    size_t row;                 // bytes per row
+    int tile_rows, height;
+    const char *frame;
+    int written, syncs;
+} ck;
+
+static size_t
+checkpoint_bitmap_len(int ntiles)
+{
+    return ((size_t) ntiles + 63) / 64 * 8;
+}
+
+static void
+checkpoint_write_tile(int t)
+{
+    int y0 = t * ck.tile_rows;
+    int y1 = y0 + ck.tile_rows < ck.height ? y0 + ck.tile_rows : ck.height;
+    size_t len = (y1 - y0) * ck.row, off = 0;
+
+    while (off < len) {
+        ssize_t n = pwrite(ck.fd, ck.frame + y0 * ck.row + off, len - off, ck.data_offset + y0 * ck.row + off);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            die("checkpoint: write failed");
+        off += n;
+    }
+}
+
+static void *
+checkpoint_writer(void *arg)
+{
+    int *pending = arg;         // written, bitmap not yet updated
+    int npending = 0, finished = 0, i;
+    uint32_t last_sync = get_time();
+
+    while (!finished) {
+        int batch[64];
+        int n = 0;
+
+        pthread_mutex_lock(&ck.lock);
+        while (!ck.queued && !ck.done)
+            pthread_cond_wait(&ck.changed, &ck.lock);
+        while (ck.queued && n < 64)
+            batch[n++] = ck.queue[--ck.queued];
+        finished = ck.done && !ck.queued;
+        pthread_mutex_unlock(&ck.lock);
+
+        for (i = 0; i < n; i++) {
+            checkpoint_write_tile(batch[i]);
+            pending[npending++] = batch[i];
+        }
+
+        // data first, then the bits which claim it
+        if (npending && (finished || get_time() - last_sync >= CHECKPOINT_INTERVAL)) {
+            fdatasync(ck.fd);
+            for (i = 0; i < npending; i++)
+                ck.bitmap[pending[i] / 8] |= 1 << (pending[i] % 8);
+            if (pwrite(ck.fd, ck.bitmap, ck.bitmap_len, sizeof(struct checkpoint_header)) != (ssize_t) ck.bitmap_len)
+                die("checkpoint: bitmap write failed");
+            if (finished)
+                fdatasync(ck.fd);
+            ck.written += npending;
+            ck.syncs++;
+            npending = 0;
+            last_sync = get_time();
+        }
+    }
+    return NULL;
+}
+
+static void
+checkpoint_queue(int t)
+{
+    pthread_mutex_lock(&ck.lock);
+    ck.queue[ck.queued++] = t;
+    pthread_cond_signal(&ck.changed);
+    pthread_mutex_unlock(&ck.lock);
+}
+
+// open or create the checkpoint file, with -resume reload the finished strips
+static int
+checkpoint_open(const char *path, int resume, const struct checkpoint_header *want, void *data)
+{
+    struct checkpoint_header h;
+    int loaded = 0, t;
+
+    ck.fd = -1;
+    if (resume) {
+        ck.fd = open(path, O_RDWR);
+        if (ck.fd < 0)
+            printf("\n  checkpoint %s: not found, starting from scratch", path);
+    }
+
+    if (ck.fd >= 0) {
+        if (pread(ck.fd, &h, sizeof(h), 0) != sizeof(h) || h.magic != CHECKPOINT_MAGIC)
+            die("%s is not a checkpoint file", path);
+        if (strncmp(h.procedure, want->procedure, sizeof(h.procedure)))
+            die("checkpoint %s was rendered with -p %.32s", path, h.procedure);
+        if (memcmp(&h, want, sizeof(h)))
+            die("checkpoint %s was saved for another frame, procedure parameters or -tile", path);
+        if (pread(ck.fd, ck.bitmap, ck.bitmap_len, sizeof(h)) != (ssize_t) ck.bitmap_len)
+            die("checkpoint %s is truncated", path);
+
+        for (t = 0; t < (int) h.ntiles; t++) {
+            int y0 = t * ck.tile_rows;
+            int y1 = y0 + ck.tile_rows < ck.height ? y0 + ck.tile_rows : ck.height;
+            size_t len = (y1 - y0) * ck.row;
+
+            if (!(ck.bitmap[t / 8] & (1 << (t % 8))))
+                continue;
+            if (pread(ck.fd, (char *) data + y0 * ck.row, len, ck.data_offset + y0 * ck.row) != (ssize_t) len)
+                die("checkpoint %s is truncated", path);
+            loaded++;
+        }
+        return loaded;
+    }
+
+    ck.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (ck.fd < 0)
+        die("cannot create checkpoint %s", path);
+    if (ftruncate(ck.fd, ck.data_offset + (off_t) ck.height * ck.row) < 0
+        || pwrite(ck.fd, want, sizeof(*want), 0) != sizeof(*want)
+        || pwrite(ck.fd, ck.bitmap, ck.bitmap_len, sizeof(*want)) != (ssize_t) ck.bitmap_len)
+        die("cannot write checkpoint %s", path);
+    fdatasync(ck.fd);
+    return 0;
+}
+
+void
+checkpoint_render(const char *path, int resume, mandelbrot_fn function, const char *procedure, float Re_min,
+                  float Re_max, float Im_min, float Im_max, float threshold, int maxiters, int width, int height,
+                  int tile_rows, int elem, void *data)
+{
+    struct checkpoint_header want;
+    pthread_t writer;
+    unsigned char *finished;    // the writer updates ck.bitmap concurrently
+    int *pending;
+    int loaded, t;
+
+    memset(&want, 0, sizeof(want));
+    want.magic = CHECKPOINT_MAGIC;
+    want.width = width;
+    want.height = height;
+    want.Re_min = Re_min;
+    want.Re_max = Re_max;
+    want.Im_min = Im_min;
+    want.Im_max = Im_max;
+    want.threshold = threshold;
+    want.maxiters = maxiters;
+    want.elem = ELEM_SIZE(elem);
+    want.tile_rows = tile_rows;
+    want.ntiles = (height + tile_rows - 1) / tile_rows;
+    snprintf(want.procedure, sizeof(want.procedure), "%s", procedure);
+    want.julia_Cre = julia_Cre;
+    want.julia_Cim = julia_Cim;
+
+    memset(&ck, 0, sizeof(ck));
+    pthread_mutex_init(&ck.lock, NULL);
+    pthread_cond_init(&ck.changed, NULL);
+    ck.row = (size_t) width * ELEM_SIZE(elem);
+    ck.tile_rows = tile_rows;
+    ck.height = height;
+    ck.frame = data;
+    ck.bitmap_len = checkpoint_bitmap_len(want.ntiles);
+    ck.data_offset = (sizeof(want) + ck.bitmap_len + CHECKPOINT_ALIGN - 1) / CHECKPOINT_ALIGN * CHECKPOINT_ALIGN;
+    ck.bitmap = calloc(ck.bitmap_len, 1);
+    ck.queue = malloc(want.ntiles * sizeof(int));
+    pending = malloc(want.ntiles * sizeof(int));
+    if (!ck.bitmap || !ck.queue || !pending)
+        die("checkpoint: out of memory");
+
+    loaded = checkpoint_open(path, resume, &want, data);
+    finished = malloc(ck.bitmap_len);
+    if (!finished)
+        die("checkpoint: out of memory");
+    memcpy(finished, ck.bitmap, ck.bitmap_len);
+    pthread_create(&writer, NULL, checkpoint_writer, pending);
+
+    for (t = 0; t < (int) want.ntiles; t++) {
+        int y0 = t * tile_rows;
+        int y1 = y0 + tile_rows < height ? y0 + tile_rows : height;
+
+        if (finished[t / 8] & (1 << (t % 8)))
+            continue;
+        function(Re_min, Re_max, Im_min, Im_max, threshold, maxiters, width, height, y0, y1 - y0, elem,
+                 (char *) data + y0 * ck.row);
+        if (render_cancelled())
+            break;
+        checkpoint_queue(t);
+    }
+
+    pthread_mutex_lock(&ck.lock);
+    ck.done = 1;
+    pthread_cond_signal(&ck.changed);
+    pthread_mutex_unlock(&ck.lock);
+    pthread_join(writer, NULL);
+    close(ck.fd);
+
+    printf("\n  checkpoint %s: %d strips resumed, %d rendered, %d syncs\n", path, loaded, ck.written, ck.syncs);
+
+    free(finished);
+    free(ck.bitmap);
+    free(ck.queue);
+    free(pending);
+}
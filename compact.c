@@ -0,0 +1,287 @@
+//=== Compact iteration store ============================================
+//
+// -compact keeps the frame as COMPACT_SIZE x COMPACT_SIZE tiles, each one
+// stored as the smallest of
+//   constant  all counts equal (interior, flat exterior): no data
+//   delta     each count minus its left neighbour (the one above in the
+//             first column), zigzag coded and bit-packed in 64-bit words,
+//             each row at the width of its largest one
+//   raw       the counts as rendered
+// The procedure renders bands of COMPACT_SIZE rows into a single scratch
+// band; the openmp threads encode the tiles of a finished band, and the
+// band is reused for the next one.  The working memory is then the encoded
+// tiles and one band instead of the whole frame.  With -pgm the frame is
+// decoded band by band, normalized on the min and max kept by every tile.
+
+#define COMPACT_SIZE  64
+#define COMPACT_WORDS ((COMPACT_SIZE * COMPACT_SIZE * 33 + 63) / 64)   // packed words, 33 bits at most
+
+enum { COMPACT_CONST, COMPACT_DELTA, COMPACT_RAW };
+
+struct compact_tile {
+    uint8_t kind;
+    uint32_t min, max;          // the constant is min
+    uint32_t bytes;
+    void *data;
+};
+
+static struct compact_frame {
+    unsigned width, height, tiles_x, tiles_y;
+    int elem;
+    struct compact_tile *tile;
+    uint64_t bytes;             // encoded data and tile descriptors
+    size_t kinds[3];
+} cf;
+
+static inline uint64_t
+compact_zigzag(uint32_t count, uint32_t pred)
+{
+    int64_t d = (int64_t) count - pred;
+
+    return (uint64_t) (d << 1) ^ (uint64_t) (d >> 63);
+}
+
+// count at x, y of a band and its prediction: left neighbour, the one above
+// in the first column
+static inline uint64_t
+compact_delta(const void *band, unsigned x0, unsigned x, unsigned y, uint32_t *count)
+{
+    size_t pos = (size_t) y * cf.width + x0 + x;
+    uint32_t pred = x ? load_iters(band, pos - 1, cf.elem) : y ? load_iters(band, pos - cf.width, cf.elem) : 0;
+
+    *count = load_iters(band, pos, cf.elem);
+    return compact_zigzag(*count, pred);
+}
+
+// encode the w x h tile at x0 of a band; a delta tile is the bit width of
+// each row (COMPACT_SIZE bytes) followed by the packed words
+static void
+compact_encode(const void *band, unsigned x0, unsigned w, unsigned h, struct compact_tile *t, uint64_t *words)
+{
+    size_t size = ELEM_SIZE(cf.elem), raw = (size_t) w * h * size, nbits = 0;
+    unsigned char bits[COMPACT_SIZE];
+    uint32_t lo = UINT32_MAX, hi = 0, c;
+    uint64_t acc = 0;
+    unsigned x, y, fill = 0, n = 0;
+
+    for (y = 0; y < h; y++) {
+        uint64_t top = 0;
+
+        for (x = 0; x < w; x++) {
+            top |= compact_delta(band, x0, x, y, &c);
+            lo = c < lo ? c : lo;
+            hi = c > hi ? c : hi;
+        }
+        bits[y] = top ? 64 - __builtin_clzll(top) : 0;
+        nbits += (size_t) w * bits[y];
+    }
+    t->min = lo;
+    t->max = hi;
+    t->data = NULL;
+    t->bytes = 0;
+    if (lo == hi) {
+        t->kind = COMPACT_CONST;
+        return;
+    }
+
+    if (COMPACT_SIZE + (nbits + 63) / 64 * 8 < raw) {
+        t->kind = COMPACT_DELTA;
+        for (y = 0; y < h; y++)
+            for (x = 0; x < w && bits[y]; x++) {
+                uint64_t z = compact_delta(band, x0, x, y, &c);
+
+                acc |= z << fill;
+                fill += bits[y];
+                if (fill >= 64) {
+                    words[n++] = acc;
+                    fill -= 64;
+                    acc = fill ? z >> (bits[y] - fill) : 0;
+                }
+            }
+        if (fill)
+            words[n++] = acc;
+        t->bytes = COMPACT_SIZE + n * 8;
+        t->data = malloc(t->bytes);
+        if (!t->data)
+            die("compact: out of memory");
+        memcpy(t->data, bits, COMPACT_SIZE);
+        memcpy((char *) t->data + COMPACT_SIZE, words, n * 8);
+        return;
+    }
+
+    t->kind = COMPACT_RAW;
+    t->bytes = raw;
+    t->data = malloc(raw);
+    if (!t->data)
+        die("compact: out of memory");
+    for (y = 0; y < h; y++)
+        memcpy((char *) t->data + y * w * size, (const char *) band + ((size_t) y * cf.width + x0) * size, w * size);
+}
+
+// decode a tile back into a band
+static void
+compact_decode(const struct compact_tile *t, unsigned x0, unsigned w, unsigned h, void *band)
+{
+    size_t size = ELEM_SIZE(cf.elem);
+    const unsigned char *bits = t->data;
+    const uint64_t *words = (const uint64_t *) ((const char *) t->data + COMPACT_SIZE);
+    unsigned x, y, fill = 0, n = 0;
+
+    for (y = 0; y < h; y++) {
+        char *row = (char *) band + ((size_t) y * cf.width + x0) * size;
+        uint64_t mask;
+        uint32_t prev;
+
+        switch (t->kind) {
+        case COMPACT_CONST:
+            for (x = 0; x < w; x++)
+                store_iters(row + x * size, cf.elem, t->min);
+            break;
+        case COMPACT_RAW:
+            memcpy(row, (const char *) t->data + y * w * size, w * size);
+            break;
+        default:
+            mask = (1ULL << bits[y]) - 1;
+            prev = y ? load_iters(row - (size_t) cf.width * size, 0, cf.elem) : 0;
+            for (x = 0; x < w; x++) {
+                uint64_t z = 0;
+
+                if (bits[y]) {
+                    z = words[n] >> fill;
+                    if (fill + bits[y] > 64)
+                        z |= words[n + 1] << (64 - fill);
+                    fill += bits[y];
+                    if (fill >= 64) {
+                        n++;
+                        fill -= 64;
+                    }
+                    z &= mask;
+                }
+                prev += (uint32_t) ((z >> 1) ^ -(z & 1));
+                store_iters(row + x * size, cf.elem, prev);
+            }
+            break;
+        }
+    }
+}
+
+// encode the tiles of the band at tile row ty, in parallel
+static void
+compact_band(const void *band, unsigned ty, unsigned rows)
+{
+    int tx;
+
+#if defined(_OPENMP)
+#pragma omp parallel
+#endif
+    {
+        uint64_t *words = malloc(COMPACT_WORDS * sizeof(uint64_t));
+
+        if (!words)
+            die("compact: out of memory");
+#if defined(_OPENMP)
+#pragma omp for schedule(dynamic)
+#endif
+        for (tx = 0; tx < (int) cf.tiles_x; tx++) {
+            unsigned x0 = tx * COMPACT_SIZE;
+            unsigned w = x0 + COMPACT_SIZE <= cf.width ? COMPACT_SIZE : cf.width - x0;
+
+            compact_encode(band, x0, w, rows, &cf.tile[(size_t) ty * cf.tiles_x + tx], words);
+        }
+        free(words);
+    }
+}
+
+// decode the band at tile row ty
+static void
+compact_band_decode(void *band, unsigned ty, unsigned rows)
+{
+    int tx;
+
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (tx = 0; tx < (int) cf.tiles_x; tx++) {
+        unsigned x0 = tx * COMPACT_SIZE;
+        unsigned w = x0 + COMPACT_SIZE <= cf.width ? COMPACT_SIZE : cf.width - x0;
+
+        compact_decode(&cf.tile[(size_t) ty * cf.tiles_x + tx], x0, w, rows, band);
+    }
+}
+
+void
+compact_render(mandelbrot_fn function, const char *name, int pgm, float Re_min, float Re_max, float Im_min,
+               float Im_max, float threshold, int maxiters, int width, int height, int elem)
+{
+    size_t size = ELEM_SIZE(elem), ntiles, k;
+    uint64_t raw = (uint64_t) width * height * size;
+    uint32_t encode_us = 0, decode_us, t1;
+    unsigned lo = UINT32_MAX, hi = 0, ty;
+    char image_name[256];
+    unsigned char *line;
+    void *band;
+    FILE *f;
+
+    memset(&cf, 0, sizeof(cf));
+    cf.width = width;
+    cf.height = height;
+    cf.elem = elem & ~ELEM_STREAM;
+    cf.tiles_x = (width + COMPACT_SIZE - 1) / COMPACT_SIZE;
+    cf.tiles_y = (height + COMPACT_SIZE - 1) / COMPACT_SIZE;
+    ntiles = (size_t) cf.tiles_x * cf.tiles_y;
+    cf.tile = calloc(ntiles, sizeof(*cf.tile));
+    band = aligned_alloc(64, ((size_t) COMPACT_SIZE * width * size + 63) & ~(size_t) 63);
+    if (!cf.tile || !band)
+        die("compact: out of memory");
+
+    for (ty = 0; ty < cf.tiles_y && !render_cancelled(); ty++) {
+        unsigned y0 = ty * COMPACT_SIZE;
+        unsigned rows = y0 + COMPACT_SIZE <= (unsigned) height ? COMPACT_SIZE : height - y0;
+
+        function(Re_min, Re_max, Im_min, Im_max, threshold, maxiters, width, height, y0, rows, elem, band);
+        t1 = get_time();
+        compact_band(band, ty, rows);
+        encode_us += get_time() - t1;
+    }
+
+    cf.bytes = ntiles * sizeof(*cf.tile);
+    for (k = 0; k < ntiles; k++) {
+        cf.bytes += cf.tile[k].bytes;
+        cf.kinds[cf.tile[k].kind]++;
+        lo = cf.tile[k].min < lo ? cf.tile[k].min : lo;
+        hi = cf.tile[k].max > hi ? cf.tile[k].max : hi;
+    }
+    printf("\n  compact: %zu tiles, %zu constant, %zu delta, %zu raw; %llu bytes for %llu raw (%.1fx), "
+           "encode %u us\n", ntiles, cf.kinds[COMPACT_CONST], cf.kinds[COMPACT_DELTA], cf.kinds[COMPACT_RAW],
+           (unsigned long long) cf.bytes, (unsigned long long) raw, (double) raw / cf.bytes, encode_us);
+
+    if (pgm && !render_cancelled()) {
+        // normalized as the frame pgm
+        sprintf(image_name, "%s.pgm", name);
+        f = fopen(image_name, "wb");
+        line = malloc((size_t) COMPACT_SIZE * width);
+        if (!f || !line)
+            die("cannot write %s", image_name);
+        fprintf(f, "P5\n%d %d\n255\n", width, height);
+        t1 = get_time();
+        for (ty = 0; ty < cf.tiles_y; ty++) {
+            unsigned y0 = ty * COMPACT_SIZE;
+            unsigned rows = y0 + COMPACT_SIZE <= (unsigned) height ? COMPACT_SIZE : height - y0;
+            size_t n = (size_t) rows * width, pos;
+
+            compact_band_decode(band, ty, rows);
+            for (pos = 0; pos < n; pos++)
+                line[pos] = (char) ((double) (load_iters(band, pos, cf.elem) - lo) / (double) (hi - lo + 1) * 255);
+            fwrite(line, 1, n, f);
+        }
+        decode_us = get_time() - t1;
+        fclose(f);
+        free(line);
+        printf("  compact: %s decoded in %u us\n", image_name, decode_us);
+    }
+
+    for (k = 0; k < ntiles; k++)
+        free(cf.tile[k].data);
+    free(cf.tile);
+    free(band);
+}
@@ -0,0 +1,258 @@
+//=== Render daemon ======================================================
+//
+// -daemon path listens on a unix socket and renders jobs with warm openmp
+// threads into the pre-faulted image[] buffer, so that small frames do not
+// pay process startup, thread creation and page faults.
+//
+// A job is one text line with the command line parameters of a render:
+//   -p AVX2+FMA+STITCH -w 512 -h 512 -xmin -1 -xmax 1 -ymin -1 -ymax 1 -t 4 -i 255 -pgm
+// -pgm returns the normalized pgm image, -raw (default) the iteration
+// buffer (u8, u16 or u32 from maxiters or -bits, host byte order).
+// The reply is one text line followed by the payload:
+//   OK <bytes> <format> render=<us> encode=<us>
+//   ERR <message>
+// Jobs are served in order, several jobs may be sent on one connection.
+// SIGUSR1 cancels the job being rendered, its reply is ERR cancelled.
+
+#include <sys/un.h>
+
+#define DAEMON_MAX_ARGS 64
+
+struct daemon_job {
+    mandelbrot_fn function;
+    const char *name;
+    float Re_min, Re_max, Im_min, Im_max;
+    float threshold;
+    unsigned maxiters;
+    unsigned width, height;
+    int elem;
+    int pgm;
+};
+
+// same parameters and defaults as the command line, NULL when valid
+static const char *
+daemon_parse(char *line, struct daemon_job *job, mandelbrot_fn fallback, const char *fallback_name)
+{
+    char *argv[DAEMON_MAX_ARGS], *save = NULL;
+    int argc = 0, stream = 0, i;
+
+    for (argv[argc] = strtok_r(line, " \t\r\n", &save); argv[argc] && argc < DAEMON_MAX_ARGS - 1;)
+        argv[++argc] = strtok_r(NULL, " \t\r\n", &save);
+
+    memset(job, 0, sizeof(*job));
+    job->function = fallback;
+    job->name = fallback_name;
+    job->Re_min = job->Im_min = -2.0;
+    job->Re_max = job->Im_max = +2.0;
+    job->threshold = 20.0;
+    job->maxiters = 255;
+    job->width = job->height = 512;
+
+    for (i = 0; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (!strcmp(arg, "-pgm")) {
+            job->pgm = 1;
+            continue;
+        }
+        if (!strcmp(arg, "-raw")) {
+            job->pgm = 0;
+            continue;
+        }
+        if (!strcmp(arg, "-stream")) {
+            stream = 1;
+            continue;
+        }
+        if (!val)
+            return "missing value";
+        i++;
+        if (!strcmp(arg, "-p")) {
+            const struct procedure *proc = find_procedure(val);
+
+            if (!proc)
+                return "unknown procedure";
+            job->function = proc->function;
+            job->name = proc->name;
+        } else if (!strcmp(arg, "-w"))
+            job->width = atoi(val);
+        else if (!strcmp(arg, "-h"))
+            job->height = atoi(val);
+        else if (!strcmp(arg, "-xmin"))
+            job->Re_min = atof(val);
+        else if (!strcmp(arg, "-xmax"))
+            job->Re_max = atof(val);
+        else if (!strcmp(arg, "-ymin"))
+            job->Im_min = atof(val);
+        else if (!strcmp(arg, "-ymax"))
+            job->Im_max = atof(val);
+        else if (!strcmp(arg, "-t"))
+            job->threshold = atof(val);
+        else if (!strcmp(arg, "-i"))
+            job->maxiters = atoi(val);
+        else if (!strcmp(arg, "-bits")) {
+            job->elem = atoi(val) / 8;
+            if (job->elem != ELEM_U8 && job->elem != ELEM_U16 && job->elem != ELEM_U32)
+                return "-bits must be 8, 16 or 32";
+        } else
+            return "unknown parameter";
+    }
+
+    if (!job->width || !job->height || job->width % 16 || job->height % 16)
+        return "width and height must be multiples of 16";
+    if (job->Re_min >= job->Re_max || job->Im_min >= job->Im_max)
+        return "wrong window definition";
+    if (job->threshold <= 1)
+        return "threshold must be greater than 1";
+
+    if (!job->elem)
+        job->elem = elem_for_maxiters(job->maxiters);
+    if ((size_t) job->width * job->height * ELEM_SIZE(job->elem) > sizeof(image))
+        return "frame larger than the daemon buffer";
+    if (stream)
+        job->elem |= ELEM_STREAM;
+    return NULL;
+}
+
+// normalize like the -pgm output of the command line, into a header + pixels buffer
+static size_t
+daemon_encode_pgm(const struct daemon_job *job, const void *frame, unsigned char *out)
+{
+    size_t n = (size_t) job->width * job->height, pos;
+    unsigned miniters = job->maxiters + 2, maxiters = 0;
+    int hlen = sprintf((char *) out, "P5\n%u %u\n255\n", job->width, job->height);
+
+    for (pos = 0; pos < n; pos++) {
+        unsigned pix = load_iters(frame, pos, job->elem);
+
+        maxiters = pix > maxiters ? pix : maxiters;
+        miniters = pix < miniters ? pix : miniters;
+    }
+    for (pos = 0; pos < n; pos++) {
+        double pixel = (double) (load_iters(frame, pos, job->elem) - miniters) / (double) (maxiters - miniters + 1) * (double) 255;
+
+        out[hlen + pos] = (unsigned char) pixel;
+    }
+    return hlen + n;
+}
+
+// read one line, 0 at end of connection
+static int
+daemon_readline(int fd, char *line, size_t len)
+{
+    size_t n = 0;
+
+    while (n + 1 < len) {
+        ssize_t r = recv(fd, line + n, 1, 0);
+
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return 0;
+        if (line[n] == '\n')
+            break;
+        n++;
+    }
+    line[n] = 0;
+    return 1;
+}
+
+static void
+daemon_session(int fd, mandelbrot_fn fallback, const char *fallback_name, unsigned char *encoded)
+{
+    static unsigned jobs;
+    char line[1024];
+
+    while (daemon_readline(fd, line, sizeof(line))) {
+        struct daemon_job job;
+        const char *err;
+        const void *payload = image;
+        size_t bytes;
+        uint32_t t0 = get_time(), t1, t2, t3;
+        int len;
+
+        if (!line[0])
+            continue;
+        err = daemon_parse(line, &job, fallback, fallback_name);
+        if (err) {
+            len = snprintf(line, sizeof(line), "ERR %s\n", err);
+            if (send_all(fd, line, len))
+                break;
+            continue;
+        }
+
+        __atomic_store_n(&render_cancel, 0, __ATOMIC_RELAXED);
+        t1 = get_time();
+        job.function(job.Re_min, job.Re_max, job.Im_min, job.Im_max, job.threshold, job.maxiters,
+                     job.width, job.height, 0, job.height, job.elem, image);
+        t2 = get_time();
+        if (render_cancelled()) {
+            len = snprintf(line, sizeof(line), "ERR cancelled after %u us\n", t2 - t1);
+            printf("job %u: %s %ux%u cancelled after %u us\n", ++jobs, job.name, job.width, job.height, t2 - t1);
+            fflush(stdout);
+            if (send_all(fd, line, len))
+                break;
+            continue;
+        }
+        if (job.pgm) {
+            bytes = daemon_encode_pgm(&job, image, encoded);
+            payload = encoded;
+        } else
+            bytes = (size_t) job.width * job.height * ELEM_SIZE(job.elem);
+        t3 = get_time();
+
+        len = snprintf(line, sizeof(line), "OK %zu %s render=%u encode=%u\n", bytes, job.pgm ? "pgm" : "raw",
+                       t2 - t1, t3 - t2);
+        if (send_all(fd, line, len) || send_all(fd, payload, bytes))
+            break;
+
+        // latency from the end of the request line to the last byte sent
+        printf("job %u: %s %ux%u u%d %s, render %u us, encode %u us, latency %u us\n", ++jobs, job.name,
+               job.width, job.height, ELEM_SIZE(job.elem) * 8, job.pgm ? "pgm" : "raw", t2 - t1, t3 - t2,
+               get_time() - t0);
+        fflush(stdout);
+    }
+    close(fd);
+}
+
+void
+daemon_serve(const char *path, mandelbrot_fn fallback, const char *fallback_name)
+{
+    struct sockaddr_un addr;
+    unsigned char *encoded;
+    uint32_t t1;
+    int lfd, fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        die("daemon: socket path too long");
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (lfd < 0 || bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) || listen(lfd, 16))
+        die("daemon: cannot listen on %s", path);
+
+    // warm up: fault in image[] and the pgm buffer from the render threads,
+    // and let openmp create its thread pool
+    t1 = get_time();
+    first_touch(image, WIDTH, HEIGHT, ELEM_U16);
+    encoded = malloc(64 + (size_t) WIDTH * HEIGHT);
+    if (!encoded)
+        die("daemon: cannot allocate the encode buffer");
+    memset(encoded, 0, 64 + (size_t) WIDTH * HEIGHT);
+    fallback(-2.0, 2.0, -2.0, 2.0, 4.0, 255, 512, 512, 0, 512, ELEM_U8, image);
+    printf("Daemon listening on %s, %s, warm up %u us\n", path, fallback_name, get_time() - t1);
+    fflush(stdout);
+    progress_catch(SIGUSR1, 1);
+
+    for (;;) {
+        fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            die("daemon: accept failed");
+        }
+        daemon_session(fd, fallback, fallback_name, encoded);
+    }
+}
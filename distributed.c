@@ -0,0 +1,402 @@
+//=== Distributed rendering ==============================================
+//
+// -worker [host:]port serves render requests over tcp, one connection at a
+// time, each request is rendered with the local SIMD procedures.
+//
+// -coordinator host:port,host:port,... splits the frame into strips of -tile
+// rows and hands them to the workers, one connection and one thread per
+// worker.  A strip whose worker fails or times out goes back to the queue
+// and is retried on any worker, up to NET_RETRIES times; a worker which
+// cannot be reached gives its strip back without using up those retries,
+// and is itself given up after NET_RETRIES failures.
+//
+// Messages are raw structs: coordinator and workers must share the byte
+// order and the struct layout (x86-64 builds of this program).
+
+#include <errno.h>
+#include <signal.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define NET_MAGIC   0x444e414dU    // "MAND"
+#define NET_RETRIES 3
+#define NET_TIMEOUT 600         // seconds without an answer before a worker is considered dead
+#define NET_MAX_BYTES (1UL << 30)       // largest strip a worker renders
+
+struct net_job {
+    uint32_t magic;
+    char procedure[32];
+    float Re_min, Re_max, Im_min, Im_max;
+    float threshold;
+    int32_t maxiters;
+    int32_t width, height;
+    int32_t elem;
+    int32_t y0, frame_height;   // the rows are [y0, y0 + height) of the frame of the window
+};
+
+struct net_reply {
+    uint32_t magic;
+    int32_t status;             // 0 = ok, payload follows
+    uint64_t bytes;
+    uint32_t render_us;
+};
+
+int
+send_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int
+recv_all(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+
+    while (len) {
+        ssize_t n = recv(fd, p, len, 0);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// "host:port" or "port", host defaults to every interface (listen) or localhost
+static struct addrinfo *
+net_resolve(const char *address, int passive)
+{
+    struct addrinfo hints, *res = NULL;
+    char host[256];
+    const char *port = strrchr(address, ':');
+
+    if (port) {
+        snprintf(host, sizeof(host), "%.*s", (int) (port - address), address);
+        port++;
+    } else {
+        host[0] = 0;
+        port = address;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    if (getaddrinfo(host[0] ? host : NULL, port, &hints, &res))
+        return NULL;
+    return res;
+}
+
+int
+net_connect(const char *address)
+{
+    struct addrinfo *res = net_resolve(address, 0), *ai;
+    struct timeval tv = { NET_TIMEOUT, 0 };
+    int one = 1;
+    int fd = -1;
+
+    for (ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (!connect(fd, ai->ai_addr, ai->ai_addrlen))
+            break;
+        close(fd);
+        fd = -1;
+    }
+    if (res)
+        freeaddrinfo(res);
+    if (fd >= 0) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+int
+net_listen(const char *address)
+{
+    struct addrinfo *res = net_resolve(address, 1), *ai;
+    int one = 1;
+    int fd = -1;
+
+    for (ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (!bind(fd, ai->ai_addr, ai->ai_addrlen) && !listen(fd, 16))
+            break;
+        close(fd);
+        fd = -1;
+    }
+    if (res)
+        freeaddrinfo(res);
+    return fd;
+}
+
+//--- worker ---------------------------------------------------------------
+
+// serve one coordinator connection until it closes
+static void
+worker_session(int fd)
+{
+    struct net_job job;
+    void *tile = NULL;
+    size_t tile_len = 0;
+
+    while (!recv_all(fd, &job, sizeof(job))) {
+        struct net_reply reply = { NET_MAGIC, 0, 0, 0 };
+        const struct procedure *proc;
+        uint32_t t1;
+
+        job.procedure[sizeof(job.procedure) - 1] = 0;
+        if (job.magic != NET_MAGIC || job.width <= 0 || job.height <= 0 || job.width % 16 || job.height % 2
+            || (job.elem & ~(ELEM_STREAM | 0x0f))
+            || (ELEM_SIZE(job.elem) != ELEM_U8 && ELEM_SIZE(job.elem) != ELEM_U16 && ELEM_SIZE(job.elem) != ELEM_U32)
+            || job.y0 < 0 || job.height > job.frame_height || job.y0 > job.frame_height - job.height
+            || (uint64_t) job.width * job.height * ELEM_SIZE(job.elem) > NET_MAX_BYTES) {
+            reply.status = -1;
+            send_all(fd, &reply, sizeof(reply));
+            break;
+        }
+
+        // a binary without the procedure would mix procedures in the frame
+        proc = find_procedure(job.procedure);
+        if (!proc) {
+            fprintf(stderr, "worker: no procedure %s in this binary\n", job.procedure);
+            reply.status = -1;
+            if (send_all(fd, &reply, sizeof(reply)))
+                break;
+            continue;
+        }
+
+        reply.bytes = (uint64_t) job.width * job.height * ELEM_SIZE(job.elem);
+        if (reply.bytes > tile_len) {
+            free(tile);
+            tile_len = reply.bytes;
+            tile = aligned_alloc(64, (tile_len + 63) & ~(size_t) 63);
+            if (!tile) {
+                fprintf(stderr, "worker: cannot allocate %zu bytes\n", tile_len);
+                tile_len = 0;
+                reply.status = -1;
+                reply.bytes = 0;
+                send_all(fd, &reply, sizeof(reply));
+                break;
+            }
+        }
+
+        t1 = get_time();
+        proc->function(job.Re_min, job.Re_max, job.Im_min, job.Im_max, job.threshold, job.maxiters,
+                       job.width, job.frame_height, job.y0, job.height, job.elem, tile);
+        reply.render_us = get_time() - t1;
+
+        if (send_all(fd, &reply, sizeof(reply)) || send_all(fd, tile, reply.bytes))
+            break;
+    }
+    free(tile);
+    close(fd);
+}
+
+void
+worker_serve(const char *address)
+{
+    int lfd = net_listen(address);
+
+    if (lfd < 0)
+        die("worker: cannot listen on %s", address);
+    printf("Worker listening on %s\n", address);
+    fflush(stdout);
+
+    for (;;) {
+        int fd = accept(lfd, NULL, NULL);
+
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            die("worker: accept failed");
+        }
+        worker_session(fd);
+    }
+}
+
+//--- coordinator ----------------------------------------------------------
+
+enum { TILE_TODO, TILE_BUSY, TILE_DONE };
+
+static struct coordinator {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int ntiles;
+    int remaining;              // tiles not done
+    int failed;                 // a tile ran out of retries
+    unsigned char *state;
+    unsigned char *attempts;
+
+    struct net_job job;         // whole frame, y0 and height are per tile
+    int height;
+    int tile_rows;
+    char *frame;
+} co;
+
+struct coordinator_worker {
+    pthread_t thread;
+    const char *address;
+    int tiles;
+    int errors;
+    uint32_t render_us;
+};
+
+// next tile to render, -1 when every tile is done or a tile failed for good
+static int
+coordinator_next(void)
+{
+    int t = -1, i;
+
+    pthread_mutex_lock(&co.lock);
+    while (co.remaining && !co.failed && !render_cancelled()) {
+        for (i = 0; i < co.ntiles; i++)
+            if (co.state[i] == TILE_TODO)
+                break;
+        if (i < co.ntiles) {
+            co.state[i] = TILE_BUSY;
+            t = i;
+            break;
+        }
+        // only busy tiles are left, wait in case one of them comes back
+        pthread_cond_wait(&co.changed, &co.lock);
+    }
+    pthread_mutex_unlock(&co.lock);
+    return t;
+}
+
+// ok: tile done, else back to the queue, charged to its retries if tried
+static void
+coordinator_finish(int t, int ok, int tried)
+{
+    pthread_mutex_lock(&co.lock);
+    if (ok) {
+        co.state[t] = TILE_DONE;
+        co.remaining--;
+    } else {
+        co.state[t] = TILE_TODO;
+        if (tried && ++co.attempts[t] > NET_RETRIES)
+            co.failed = 1;
+    }
+    pthread_cond_broadcast(&co.changed);
+    pthread_mutex_unlock(&co.lock);
+}
+
+static void *
+coordinator_thread(void *arg)
+{
+    struct coordinator_worker *w = arg;
+    size_t row = (size_t) co.job.width * ELEM_SIZE(co.job.elem);
+    int fd = -1;
+    int t;
+
+    while ((t = coordinator_next()) >= 0) {
+        struct net_job job = co.job;
+        struct net_reply reply;
+        int y0 = t * co.tile_rows;
+        int y1 = y0 + co.tile_rows < co.height ? y0 + co.tile_rows : co.height;
+
+        job.y0 = y0;
+        job.height = y1 - y0;
+
+        if (fd < 0)
+            fd = net_connect(w->address);
+        if (fd >= 0 && !send_all(fd, &job, sizeof(job)) && !recv_all(fd, &reply, sizeof(reply))
+            && reply.magic == NET_MAGIC && reply.status == 0 && reply.bytes == row * job.height
+            && !recv_all(fd, co.frame + y0 * row, reply.bytes)) {
+            w->tiles++;
+            w->render_us += reply.render_us;
+            coordinator_finish(t, 1, 1);
+            continue;
+        }
+
+        // reconnect on the next tile, give up on this worker after NET_RETRIES errors;
+        // the tile only counts the failures of a worker it was sent to
+        coordinator_finish(t, 0, fd >= 0);
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+        if (++w->errors > NET_RETRIES) {
+            fprintf(stderr, "worker %s: giving up\n", w->address);
+            break;
+        }
+        usleep(200000);
+    }
+    if (fd >= 0)
+        close(fd);
+    return NULL;
+}
+
+void
+coordinator_render(const char *workers, const char *procedure, float Re_min, float Re_max, float Im_min,
+                   float Im_max, float threshold, int maxiters, int width, int height, int tile_rows, int elem,
+                   void *data)
+{
+    struct coordinator_worker *w;
+    char *list = strdup(workers), *tok, *save = NULL;
+    int nworkers = 0, i;
+
+    memset(&co, 0, sizeof(co));
+    pthread_mutex_init(&co.lock, NULL);
+    pthread_cond_init(&co.changed, NULL);
+    co.job.magic = NET_MAGIC;
+    snprintf(co.job.procedure, sizeof(co.job.procedure), "%s", procedure);
+    co.job.Re_min = Re_min;
+    co.job.Re_max = Re_max;
+    co.job.Im_min = Im_min;
+    co.job.Im_max = Im_max;
+    co.job.threshold = threshold;
+    co.job.maxiters = maxiters;
+    co.job.width = width;
+    co.job.elem = ELEM_SIZE(elem);
+    co.job.frame_height = height;
+    co.height = height;
+    co.tile_rows = tile_rows;
+    co.frame = data;
+    co.ntiles = (height + tile_rows - 1) / tile_rows;
+    co.remaining = co.ntiles;
+    co.state = calloc(co.ntiles, 1);
+    co.attempts = calloc(co.ntiles, 1);
+
+    w = calloc(strlen(workers) / 2 + 1, sizeof(*w));
+    for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        w[nworkers].address = tok;
+        pthread_create(&w[nworkers].thread, NULL, coordinator_thread, &w[nworkers]);
+        nworkers++;
+    }
+    for (i = 0; i < nworkers; i++) {
+        pthread_join(w[i].thread, NULL);
+        printf("\n  worker %s: %d tiles, %d errors, %u us rendering", w[i].address, w[i].tiles, w[i].errors,
+               w[i].render_us);
+    }
+    putchar('\n');
+    if (co.remaining)
+        die("%d of %d tiles could not be rendered", co.remaining, co.ntiles);
+
+    free(co.state);
+    free(co.attempts);
+    free(w);
+    free(list);
+}
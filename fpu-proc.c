@@ -1,21 +1,24 @@
 //=== C reference implementation =========================================
 void
 ORIG_mandelbrot(float Re_min, float Re_max,
-                float Im_min, float Im_max, float threshold, int maxiters, int width, int height, uint16_t * data)
+                float Im_min, float Im_max, float threshold, int maxiters,
+                int width, int height, int y0, int rows, int elem, void *data)
 {
     float dRe, dIm;
     float Cre, Cim, Xre, Xim, Tre, Tim;
     int x, y, i;
 
-    uint16_t *ptr = data;
+    char *ptr = data;
 
     // step on Re and Im axis
     dRe = (Re_max - Re_min) / width;
     dIm = (Im_max - Im_min) / height;
 
-    Cim = Im_min;
+    Cim = band_im(Im_min, dIm, y0);
 
-    for (y = 0; y < height; y++) {
+    for (y = 0; y < rows; y++) {
+        if (render_cancelled())
+            break;
         Cre = Re_min;
         for (x = 0; x < width; x++) {
             Xre = 0.0;
@@ -31,31 +34,36 @@ ORIG_mandelbrot(float Re_min, float Re_max,
                 Xim = Tim;
             }
 
-            *ptr++ = i;
+            store_iters(ptr, elem, i);
+            ptr += ELEM_SIZE(elem);
             Cre += dRe;
         }
 
         Cim += dIm;
+        progress_rows(1, (char *) data + (size_t) y * width * ELEM_SIZE(elem), width, elem);
     }
 }
 
 void
 FPU_mandelbrot(float Re_min, float Re_max,
-               float Im_min, float Im_max, float threshold, int maxiters, int width, int height, uint16_t * data)
+               float Im_min, float Im_max, float threshold, int maxiters,
+               int width, int height, int y0, int rows, int elem, void *data)
 {
     float dRe, dIm;
     float Cre, Cim, Xre, Xim, Xrm;
     int x, y, i;
 
-    uint16_t *ptr = data;
+    char *ptr = data;
 
     // step on Re and Im axis
     dRe = (Re_max - Re_min) / width;
     dIm = (Im_max - Im_min) / height;
 
-    Cim = Im_min;
+    Cim = band_im(Im_min, dIm, y0);
 
-    for (y = 0; y < height; y++) {
+    for (y = 0; y < rows; y++) {
+        if (render_cancelled())
+            break;
         Cre = Re_min;
         for (x = 0; x < width; x++) {
             Xrm = Cim * Cre;
@@ -73,10 +81,317 @@ FPU_mandelbrot(float Re_min, float Re_max,
                 Xrm += Xrm;
             }
 
-            *ptr++ = i;
+            store_iters(ptr, elem, i);
+            ptr += ELEM_SIZE(elem);
             Cre += dRe;
         }
 
         Cim += dIm;
+        progress_rows(1, (char *) data + (size_t) y * width * ELEM_SIZE(elem), width, elem);
+    }
+}
+
+//=== C reference implementation, point lists ============================
+// iterate n points from their current z and count for at most iters more
+// iterations; z is left at the last value tested, so that points which
+// reach the limit can be resumed later with a larger one
+void
+FPU_mandelbrot_points(float threshold, int iters, int n, const float *Cre, const float *Cim, float *Zre, float *Zim,
+                      uint32_t *count)
+{
+    float Xre, Xim, Xre2, Xim2;
+    int k, i;
+
+    for (k = 0; k < n; k++) {
+        Xre = Zre[k];
+        Xim = Zim[k];
+        for (i = 0; i < iters; i++) {
+            Xre2 = Xre * Xre;
+            Xim2 = Xim * Xim;
+            if (Xre2 + Xim2 > threshold)
+                break;
+            Xim = 2 * Xre * Xim + Cim[k];
+            Xre = Xre2 - Xim2 + Cre[k];
+        }
+        Zre[k] = Xre;
+        Zim[k] = Xim;
+        count[k] += i;
+    }
+}
+
+//=== C reference implementation, distance estimation ====================
+// iterate dz/dc along with z: dz' = 2 z dz + 1, starting from dz = 1 as
+// z starts at c; distance per pixel, 0 for the pixels which reach maxiters
+void
+FPU_mandelbrot_distance(float Re_min, float Re_max, float Im_min, float Im_max, float threshold, int maxiters,
+                        int width, int height, float *distance)
+{
+    float dRe = (Re_max - Re_min) / width;
+    float dIm = (Im_max - Im_min) / height;
+    float Cre, Cim, Xre, Xim, Xre2, Xim2, Dre, Dim, Pre;
+    int x, y, i;
+
+    for (y = 0; y < height; y++) {
+        if (render_cancelled())
+            break;
+        Cim = Im_min + y * dIm;
+        for (x = 0; x < width; x++) {
+            Cre = Re_min + x * dRe;
+            Xre = Cre;
+            Xim = Cim;
+            Dre = 1;
+            Dim = 0;
+            for (i = 0; i < maxiters; i++) {
+                Xre2 = Xre * Xre;
+                Xim2 = Xim * Xim;
+                if (Xre2 + Xim2 > threshold)
+                    break;
+                Pre = Xre * Dre - Xim * Dim;
+                Dim = 2 * (Xre * Dim + Xim * Dre);
+                Dre = 2 * Pre + 1;
+                Xim = 2 * Xre * Xim + Cim;
+                Xre = Xre2 - Xim2 + Cre;
+            }
+            *distance++ = i < maxiters ? distance_estimate(Xre, Xim, Dre, Dim) : 0;
+        }
+        progress_rows(1, NULL, 0, 0);
     }
 }
+
+//=== C reference implementation, fixed point ============================
+// signed Q7.56 fixed point: exact integer arithmetic, so every procedure
+// built on it gives the same counts on every instruction set.  While
+// |z|^2 <= threshold all intermediates stay below 128 provided the window
+// lies within +-64 and the threshold is at most FIXED_MAX_THRESHOLD; a
+// larger threshold is clamped.  Components above sqrt(threshold) escape
+// before they are squared, so squares never overflow either.
+#define FIXED_FRAC          56
+#define FIXED_MAX_THRESHOLD 63.0
+
+__extension__ typedef unsigned __int128 fixed_u128;
+
+static inline int64_t
+fixed_from_double(double v)
+{
+    return (int64_t) llround(ldexp(v, FIXED_FRAC));
+}
+
+// product truncated towards zero, as the SIMD versions compute it on the
+// magnitudes
+static inline int64_t
+fixed_mul(int64_t a, int64_t b)
+{
+    uint64_t ua = a < 0 ? -(uint64_t) a : (uint64_t) a;
+    uint64_t ub = b < 0 ? -(uint64_t) b : (uint64_t) b;
+    uint64_t r = (uint64_t) (((fixed_u128) ua * ub) >> FIXED_FRAC);
+
+    return (a < 0) != (b < 0) ? -(int64_t) r : (int64_t) r;
+}
+
+// escape radius and threshold as fixed point
+static inline void
+fixed_threshold(float threshold, int64_t *R, int64_t *T)
+{
+    double t = threshold < FIXED_MAX_THRESHOLD ? threshold : FIXED_MAX_THRESHOLD;
+
+    *T = fixed_from_double(t);
+    *R = fixed_from_double(sqrt(t));
+}
+
+void
+FPU_FIXED_mandelbrot(float Re_min, float Re_max, float Im_min, float Im_max, float threshold, int maxiters, int width,
+                     int height, int y0, int rows, int elem, void *data)
+{
+    int64_t dRe = fixed_from_double(((double) Re_max - Re_min) / width);
+    int64_t dIm = fixed_from_double(((double) Im_max - Im_min) / height);
+    int64_t Re0 = fixed_from_double(Re_min), Im0 = fixed_from_double(Im_min);
+    int64_t Cre, Cim, Xre, Xim, Xre2, Xim2, Xrm, R, T;
+    char *ptr = data;
+    int x, y, i;
+
+    fixed_threshold(threshold, &R, &T);
+
+    for (y = 0; y < rows; y++) {
+        if (render_cancelled())
+            break;
+        Cim = Im0 + (y0 + y) * dIm;
+        for (x = 0; x < width; x++) {
+            Cre = Re0 + x * dRe;
+            Xre = Cre;
+            Xim = Cim;
+            for (i = 0; i < maxiters; i++) {
+                if (Xre > R || Xre < -R || Xim > R || Xim < -R)
+                    break;
+                Xre2 = fixed_mul(Xre, Xre);
+                Xim2 = fixed_mul(Xim, Xim);
+                if (Xre2 + Xim2 > T)
+                    break;
+                Xrm = fixed_mul(Xre, Xim);
+                Xim = Xrm + Xrm + Cim;
+                Xre = Xre2 - Xim2 + Cre;
+            }
+            store_iters(ptr, elem, i);
+            ptr += ELEM_SIZE(elem);
+        }
+        progress_rows(1, (char *) data + (size_t) y * width * ELEM_SIZE(elem), width, elem);
+    }
+}
+
+//=== C reference implementation, double point lists =====================
+// counts of n arbitrary points from z = c, iterated in double
+void
+FPU_mandelbrot_points_double(float threshold, int iters, int n, const double *Cre, const double *Cim, uint32_t *count)
+{
+    double Xre, Xim, Xre2, Xim2;
+    int k, i;
+
+    for (k = 0; k < n; k++) {
+        Xre = Cre[k];
+        Xim = Cim[k];
+        for (i = 0; i < iters; i++) {
+            Xre2 = Xre * Xre;
+            Xim2 = Xim * Xim;
+            if (Xre2 + Xim2 > threshold)
+                break;
+            Xim = 2 * Xre * Xim + Cim[k];
+            Xre = Xre2 - Xim2 + Cre[k];
+        }
+        count[k] = i;
+    }
+}
+
+//=== C reference implementation, point queries ==========================
+// counts of n arbitrary points, from z = c
+void
+FPU_mandelbrot_query(float threshold, int maxiters, int n, const float *Cre, const float *Cim, uint32_t *count)
+{
+    float Xre, Xim, Xre2, Xim2;
+    int k, i;
+
+    for (k = 0; k < n; k++) {
+        Xre = Cre[k];
+        Xim = Cim[k];
+        for (i = 0; i < maxiters; i++) {
+            Xre2 = Xre * Xre;
+            Xim2 = Xim * Xim;
+            if (Xre2 + Xim2 > threshold)
+                break;
+            Xim = 2 * Xre * Xim + Cim[k];
+            Xre = Xre2 - Xim2 + Cre[k];
+        }
+        count[k] = i;
+    }
+}
+
+//=== C reference implementation, Buddhabrot orbits ======================
+// re-trace the orbits of n points (z = c first) and add each orbit point
+// still within the threshold to the histogram of the window mapped by
+// (x - Re_min) * scale_re, (y - Im_min) * scale_im
+void
+FPU_buddhabrot_trace(float threshold, int maxiters, int n, const float *Cre, const float *Cim, float Re_min,
+                     float Im_min, float scale_re, float scale_im, int width, int height, uint32_t *hist)
+{
+    float Xre, Xim, Xre2, Xim2, fx, fy;
+    int k, i;
+
+    for (k = 0; k < n; k++) {
+        Xre = Cre[k];
+        Xim = Cim[k];
+        for (i = 0; i < maxiters; i++) {
+            Xre2 = Xre * Xre;
+            Xim2 = Xim * Xim;
+            if (Xre2 + Xim2 > threshold)
+                break;
+            fx = (Xre - Re_min) * scale_re;
+            fy = (Xim - Im_min) * scale_im;
+            if (fx >= 0 && fx < width && fy >= 0 && fy < height)
+                hist[(size_t) fy * width + (size_t) fx]++;
+            Xim = 2 * Xre * Xim + Cim[k];
+            Xre = Xre2 - Xim2 + Cre[k];
+        }
+    }
+}
+
+//=== C reference implementation, Julia and Multibrot families ===========
+// z -> z^degree + c from z = pixel, where c is the pixel (Multibrot) or the
+// -julia constant (Julia); the count is the first k with |z_k|^2 over the
+// threshold, as for the Mandelbrot procedures.  The *_family() bodies are
+// inlined with constant julia and degree into every procedure the
+// *_FAMILY() macros declare, so the loops carry no branch on them and the
+// Mandelbrot procedures are untouched.
+
+float julia_Cre = -0.8f, julia_Cim = 0.156f;
+
+// z^degree + c for degree 2, 3 or 4
+static inline __attribute__ ((always_inline)) void
+FPU_family_step(float *Xre, float *Xim, float Cre, float Cim, const int degree)
+{
+    float x = *Xre, y = *Xim, x2 = x * x, y2 = y * y, a, b;
+
+    switch (degree) {
+    case 2:
+        *Xre = x2 - y2 + Cre;
+        *Xim = 2 * x * y + Cim;
+        break;
+    case 3:
+        *Xre = x * (x2 - 3 * y2) + Cre;
+        *Xim = y * (3 * x2 - y2) + Cim;
+        break;
+    default:                   // 4, z^2 squared
+        a = x2 - y2;
+        b = 2 * x * y;
+        *Xre = a * a - b * b + Cre;
+        *Xim = 2 * a * b + Cim;
+        break;
+    }
+}
+
+static inline __attribute__ ((always_inline)) void
+FPU_family(float Re_min, float Re_max, float Im_min, float Im_max, float threshold, int maxiters, int width,
+           int height, int y0, int rows, int elem, void *data, const int julia, const int degree)
+{
+    float dRe = (Re_max - Re_min) / width;
+    float dIm = (Im_max - Im_min) / height;
+    float Pre, Pim = band_im(Im_min, dIm, y0), Xre, Xim;
+    char *ptr = data;
+    int x, y, i;
+
+    for (y = 0; y < rows; y++) {
+        if (render_cancelled())
+            break;
+        Pre = Re_min;
+        for (x = 0; x < width; x++) {
+            float Cre = julia ? julia_Cre : Pre;
+            float Cim = julia ? julia_Cim : Pim;
+
+            Xre = Pre;
+            Xim = Pim;
+            for (i = 0; i < maxiters; i++) {
+                if (Xre * Xre + Xim * Xim > threshold)
+                    break;
+                FPU_family_step(&Xre, &Xim, Cre, Cim, degree);
+            }
+
+            store_iters(ptr, elem, i);
+            ptr += ELEM_SIZE(elem);
+            Pre += dRe;
+        }
+        Pim += dIm;
+        progress_rows(1, (char *) data + (size_t) y * width * ELEM_SIZE(elem), width, elem);
+    }
+}
+
+#define FPU_FAMILY(name, julia, degree)                                                                         \
+void                                                                                                            \
+name(float Re_min, float Re_max, float Im_min, float Im_max, float threshold, int maxiters, int width,         \
+     int height, int y0, int rows, int elem, void *data)                                                        \
+{                                                                                                               \
+    FPU_family(Re_min, Re_max, Im_min, Im_max, threshold, maxiters, width, height, y0, rows, elem, data,        \
+               julia, degree);                                                                                  \
+}
+
+FPU_FAMILY(FPU_JULIA_fractal, 1, 2)
+FPU_FAMILY(FPU_JULIA3_fractal, 1, 3)
+FPU_FAMILY(FPU_JULIA4_fractal, 1, 4)
+FPU_FAMILY(FPU_MULTI3_fractal, 0, 3)
+FPU_FAMILY(FPU_MULTI4_fractal, 0, 4)
@@ -0,0 +1,60 @@
+//=== Frame buffers ======================================================
+//
+// -hugepages backs the iteration buffer with 2 MB pages: explicit hugetlbfs
+// pages when the system has some reserved (vm.nr_hugepages), transparent
+// huge pages otherwise.  A 8192x8192 u16 frame then needs 64 TLB entries
+// instead of 32768.
+
+#include <sys/mman.h>
+
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+struct frame_buffer {
+    void *data;
+    size_t len;
+    const char *kind;
+};
+
+int
+frame_alloc_huge(struct frame_buffer *fb, size_t bytes)
+{
+    char *p;
+
+    fb->len = (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    fb->data = mmap(NULL, fb->len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (fb->data != MAP_FAILED) {
+        fb->kind = "hugetlb";
+        return 1;
+    }
+
+    // transparent huge pages need a 2 MB aligned range, map one more page
+    // and trim both ends
+    p = mmap(NULL, fb->len + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return 0;
+    fb->data = (void *) (((uintptr_t) p + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+    if ((char *) fb->data > p)
+        munmap(p, (char *) fb->data - p);
+    munmap((char *) fb->data + fb->len, p + HUGE_PAGE_SIZE - (char *) fb->data);
+    fb->kind = madvise(fb->data, fb->len, MADV_HUGEPAGE) ? "4k pages" : "thp";
+    return 1;
+}
+
+// frames larger than the static image[] buffer are mapped on demand
+int
+frame_alloc(struct frame_buffer *fb, size_t bytes, int huge)
+{
+    if (huge)
+        return frame_alloc_huge(fb, bytes);
+
+    fb->len = bytes;
+    fb->data = mmap(NULL, fb->len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    fb->kind = "4k pages";
+    return fb->data != MAP_FAILED;
+}
+
+void
+frame_free(struct frame_buffer *fb)
+{
+    munmap(fb->data, fb->len);
+}
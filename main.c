@@ -42,6 +42,7 @@
 
 */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -49,6 +50,7 @@
 #include <strings.h>
 #include <sys/time.h>
 #include <stdarg.h>
+#include <math.h>
 
 //=== helper functions ===================================================
 uint32_t
@@ -73,6 +75,137 @@ die(const char *fmt, ...)
     exit(EXIT_FAILURE);
 }
 
+//=== iteration buffers ==================================================
+// procedures store iteration counts as u8, u16 or u32 elements, the element
+// size in bytes is selected from maxiters (or forced with -bits)
+// ELEM_STREAM selects non-temporal stores (buffer must be 64 bytes aligned)
+#define ELEM_U8  1
+#define ELEM_U16 2
+#define ELEM_U32 4
+#define ELEM_STREAM 0x10
+#define ELEM_SIZE(elem) ((elem) & 0x0f)
+
+int
+elem_for_maxiters(unsigned maxiters)
+{
+    if (maxiters <= UINT8_MAX)
+        return ELEM_U8;
+    if (maxiters <= UINT16_MAX)
+        return ELEM_U16;
+    return ELEM_U32;
+}
+
+// saturating scalar store
+static inline void
+store_iters(void *ptr, int elem, unsigned iters)
+{
+    switch (ELEM_SIZE(elem)) {
+    case ELEM_U8:
+        *(uint8_t *) ptr = iters > UINT8_MAX ? UINT8_MAX : iters;
+        break;
+    case ELEM_U16:
+        *(uint16_t *) ptr = iters > UINT16_MAX ? UINT16_MAX : iters;
+        break;
+    default:
+        *(uint32_t *) ptr = iters;
+        break;
+    }
+}
+
+static inline unsigned
+load_iters(const void *data, size_t index, int elem)
+{
+    switch (ELEM_SIZE(elem)) {
+    case ELEM_U8:
+        return ((const uint8_t *) data)[index];
+    case ELEM_U16:
+        return ((const uint16_t *) data)[index];
+    default:
+        return ((const uint32_t *) data)[index];
+    }
+}
+
+// exterior distance estimate 0.5 * |z| * ln|z| / |dz/dc| at the escape
+// iteration, in double since |dz|^2 easily overflows a float; 0 when the
+// derivative overflowed, the point is then well within a pixel of the set
+static inline float
+distance_estimate(float Zre, float Zim, float Dre, float Dim)
+{
+    double z2 = (double) Zre * Zre + (double) Zim * Zim;
+    double dz = hypot(Dre, Dim);
+    uint64_t bits;
+
+    // inf or nan, tested on the bits since -ffast-math folds isfinite()
+    memcpy(&bits, &dz, sizeof(bits));
+    if ((bits >> 52 & 0x7ff) == 0x7ff || dz == 0)
+        return 0;
+    return 0.25 * sqrt(z2) * log(z2) / dz;
+}
+
+//=== progress and cancellation ==========================================
+// procedures check render_cancel before each row (row pair) and skip the
+// rest of the frame once it is set; with -progress on they also add every
+// finished row, and its iterations (the sum of its counts), to the counter
+// of their thread, which the reporter thread of progress.c sums up
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+#define PROGRESS_SLOTS 256
+
+struct progress_counter {
+    uint64_t rows, iters;
+} __attribute__ ((aligned(64)));
+
+static struct progress_counter progress_count[PROGRESS_SLOTS];
+static int progress_on;
+static int render_cancel;
+
+static inline int
+render_cancelled(void)
+{
+    return __atomic_load_n(&render_cancel, __ATOMIC_RELAXED);
+}
+
+// rows finished by the calling thread, n counts (NULL for none) of elem
+static inline void
+progress_rows(int rows, const void *counts, size_t n, int elem)
+{
+    struct progress_counter *c;
+    uint64_t sum = 0;
+    size_t pos;
+    int self = 0;
+
+    if (!__atomic_load_n(&progress_on, __ATOMIC_RELAXED))
+        return;
+#if defined(_OPENMP)
+    self = omp_get_thread_num();
+#endif
+    c = &progress_count[self % PROGRESS_SLOTS];
+    for (pos = 0; counts && pos < n; pos++)
+        sum += load_iters(counts, pos, elem);
+    __atomic_fetch_add(&c->rows, rows, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->iters, sum, __ATOMIC_RELAXED);
+}
+
+//=== frame bands ========================================================
+// the procedures compute rows [y0, y0 + rows) of the frame of the window,
+// height rows high, stepping Im over the frame height from row y0: a band
+// holds the same counts as the full frame render.  A band passed as its own
+// sub-window would get float rounded bounds and step, and drift.
+
+// Im of row y0 for the procedures which add dIm row after row, with the
+// same float adds as from row 0
+static inline float
+band_im(float Im_min, float dIm, int y0)
+{
+    while (y0-- > 0) {
+        Im_min += dIm;
+        __asm__("":"+x"(Im_min));       // no reassociation under -ffast-math
+    }
+    return Im_min;
+}
+
 #include <immintrin.h>
 
 #include "imm_inconsistent.h"
@@ -90,6 +223,10 @@ die(const char *fmt, ...)
 #if defined(AVX512)
 #include "avx512-proc-64-bit.c"
 #endif
+
+#if defined(AVX2) && defined(FMA)
+#include "avx2-jit-64-bit.c"
+#endif
 //=== Colors =============================================================
 
 
@@ -216,9 +353,117 @@ make_color(int i, int max_color)
 
 static uint16_t __attribute__ ((aligned(64))) image[WIDTH * HEIGHT];
 
+//=== procedures =========================================================
+typedef void (*mandelbrot_fn) (float Re_min, float Re_max, float Im_min, float Im_max,
+                               float threshold, int maxiters, int width, int height, int y0, int rows, int elem,
+                               void *data);
+typedef void (*mandelbrot_points_fn) (float threshold, int iters, int n, const float *Cre, const float *Cim,
+                                      float *Zre, float *Zim, uint32_t *count);
+
+enum fractal { FRACTAL_MANDELBROT, FRACTAL_MULTIBROT, FRACTAL_JULIA };
+
+static const struct procedure {
+    const char *name;
+    mandelbrot_fn function;
+    int threaded;               // scales with openmp threads
+    enum fractal fractal;
+    const char *help;
+} procedures[] = {
+    {"ORIG", ORIG_mandelbrot, 0, FRACTAL_MANDELBROT, "select unmodified naive procedure"},
+    {"FPU", FPU_mandelbrot, 0, FRACTAL_MANDELBROT, "select FPU procedure (default)"},
+    {"FIXED", FPU_FIXED_mandelbrot, 0, FRACTAL_MANDELBROT,
+     "select 64-bit fixed point C procedure (bit-exact reference)"},
+    {"FPU+JULIA", FPU_JULIA_fractal, 0, FRACTAL_JULIA, "select FPU Julia set z^2+c procedure (c from -julia)"},
+    {"FPU+JULIA3", FPU_JULIA3_fractal, 0, FRACTAL_JULIA, "select FPU Julia set z^3+c procedure"},
+    {"FPU+JULIA4", FPU_JULIA4_fractal, 0, FRACTAL_JULIA, "select FPU Julia set z^4+c procedure"},
+    {"FPU+MULTI3", FPU_MULTI3_fractal, 0, FRACTAL_MULTIBROT, "select FPU Multibrot z^3+c procedure"},
+    {"FPU+MULTI4", FPU_MULTI4_fractal, 0, FRACTAL_MULTIBROT, "select FPU Multibrot z^4+c procedure"},
+#if defined(SSE4)
+    {"SSE", SSE_mandelbrot, 0, FRACTAL_MANDELBROT, "select SSE4.1 procedure"},
+#endif
+#if defined(AVX2)
+    {"AVX2", AVX2_mandelbrot, 0, FRACTAL_MANDELBROT, "select AVX2 procedure"},
+    {"AVX2+FIXED", AVX2_FIXED_mandelbrot, 0, FRACTAL_MANDELBROT,
+     "select AVX2 64-bit fixed point procedure, same counts as FIXED"},
+#if defined(FMA)
+    {"AVX2+FMA", AVX2_FMA_mandelbrot, 0, FRACTAL_MANDELBROT, "select AVX2+FMA procedure"},
+    {"AVX2+FMA+STITCH", AVX2_FMA_STITCH_mandelbrot, 1, FRACTAL_MANDELBROT,
+     "select AVX2+FMA procedure with code stitching"},
+    {"AVX2+FMA+JIT", AVX2_FMA_JIT_mandelbrot, 1, FRACTAL_MANDELBROT,
+     "select AVX2+FMA+STITCH code generated at run time for the threshold and maxiters"},
+    {"AVX2+FMA+JULIA", AVX2_FMA_JULIA_fractal, 1, FRACTAL_JULIA, "select AVX2+FMA stitched Julia set z^2+c procedure"},
+    {"AVX2+FMA+JULIA3", AVX2_FMA_JULIA3_fractal, 1, FRACTAL_JULIA,
+     "select AVX2+FMA stitched Julia set z^3+c procedure"},
+    {"AVX2+FMA+JULIA4", AVX2_FMA_JULIA4_fractal, 1, FRACTAL_JULIA,
+     "select AVX2+FMA stitched Julia set z^4+c procedure"},
+    {"AVX2+FMA+MULTI3", AVX2_FMA_MULTI3_fractal, 1, FRACTAL_MULTIBROT,
+     "select AVX2+FMA stitched Multibrot z^3+c procedure"},
+    {"AVX2+FMA+MULTI4", AVX2_FMA_MULTI4_fractal, 1, FRACTAL_MULTIBROT,
+     "select AVX2+FMA stitched Multibrot z^4+c procedure"},
+#endif
+#endif
+#if defined(AVX512)
+    {"AVX512", AVX512_mandelbrot, 0, FRACTAL_MANDELBROT, "select AVX512 procedure"},
+#if defined(FMA)
+    {"AVX512+FMA", AVX512_FMA_mandelbrot, 0, FRACTAL_MANDELBROT, "select AVX512 using FMA instructions"},
+    {"AVX512+FMA+STITCH", AVX512_FMA_STITCH_mandelbrot, 1, FRACTAL_MANDELBROT,
+     "select AVX512+FMA procedure with code stitching"},
+    {"AVX512+FMA+MASK", AVX512_FMA_MASK_mandelbrot, 0, FRACTAL_MANDELBROT,
+     "select AVX512+FMA procedure using opmask registers"},
+    {"AVX512+FMA+MASK+STITCH", AVX512_FMA_MASK_STITCH_mandelbrot, 1, FRACTAL_MANDELBROT,
+     "select AVX512+FMA opmask procedure with code stitching"},
+    {"AVX512+FMA+JULIA", AVX512_FMA_JULIA_fractal, 1, FRACTAL_JULIA,
+     "select AVX512+FMA stitched Julia set z^2+c procedure"},
+    {"AVX512+FMA+JULIA3", AVX512_FMA_JULIA3_fractal, 1, FRACTAL_JULIA,
+     "select AVX512+FMA stitched Julia set z^3+c procedure"},
+    {"AVX512+FMA+JULIA4", AVX512_FMA_JULIA4_fractal, 1, FRACTAL_JULIA,
+     "select AVX512+FMA stitched Julia set z^4+c procedure"},
+    {"AVX512+FMA+MULTI3", AVX512_FMA_MULTI3_fractal, 1, FRACTAL_MULTIBROT,
+     "select AVX512+FMA stitched Multibrot z^3+c procedure"},
+    {"AVX512+FMA+MULTI4", AVX512_FMA_MULTI4_fractal, 1, FRACTAL_MULTIBROT,
+     "select AVX512+FMA stitched Multibrot z^4+c procedure"},
+#endif
+#endif
+    {NULL, NULL, 0, FRACTAL_MANDELBROT, NULL}
+};
+
+const struct procedure *
+find_procedure(const char *name)
+{
+    int i;
+
+    for (i = 0; procedures[i].name; i++)
+        if (strcasecmp(name, procedures[i].name) == 0)
+            return &procedures[i];
+    return NULL;
+}
+
+#include "topology.c"
+#include "progress.c"
+#include "autotune.c"
+#include "mmap-output.c"
+#include "frame.c"
+#include "distributed.c"
+#include "daemon.c"
+#include "points.c"
+#include "state.c"
+#include "checkpoint.c"
+#include "tiled.c"
+#include "pipeline.c"
+#include "png.c"
+#include "symmetry.c"
+#include "distance.c"
+#include "aa.c"
+#include "mixed.c"
+#include "query.c"
+#include "buddhabrot.c"
+#include "compact.c"
+#include "shm.c"
+
 void
 help(char *progname)
 {
+    int i;
 
     puts("SSE fractal generator (compiled 64-bit version)");
     puts("");
@@ -227,28 +472,46 @@ help(char *progname)
     puts("Parameters:");
     puts("");
     puts("-p");
-    puts("ORIG - select unmodified naive procedure");
-    puts("FPU - select FPU procedure (default)");
-    puts("SSE - select SSE4.1 procedure");
-#if defined(AVX2)
-    puts("AVX2 - select AVX2 procedure");
-#if defined(FMA)
-    puts("AVX2+FMA - select AVX2+FMA procedure");
-    puts("AVX2+FMA+STITCH - select AVX2+FMA procedure with code stitching");
-#endif
-#endif
-#if defined(AVX512)
-    puts("AVX512 - select AVX512 procedure");
-#if defined(FMA)
-    puts("AVX512+FMA - select AVX512 using FMA instructions");
-    puts("AVX512+FMA+STITCH - select AVX512+FMA procedure with code stitching");
-#endif
-#endif
+    for (i = 0; procedures[i].name; i++)
+        printf("%s - %s\n", procedures[i].name, procedures[i].help);
     puts("-xmin Remin -ymin Immin -xmax Remax -ymax Immax - define area of calculations; default -2.0 -2.0 +2.0 +2.0");
     puts("-t threshold - define max radius, greater than 0; default 20.0");
+    puts("-julia re im - constant c of the JULIA procedures; default -0.8 0.156");
     puts("-i maxiters  - define max number of iterations; default 255");
     puts("-xpm - generate xpm format (colours)");
     puts("-pgm - generate pgm format (grey scale)");
+    puts("-png - generate png format (grey scale), strips deflated in parallel");
+    puts("-bits 8|16|32 - iteration buffer element width; default from maxiters, u8 saturates");
+    puts("-mmap - write the pgm file through a shared mapping, u8 counts are stored straight into it");
+    puts("-stream - store iteration counts with non-temporal stores");
+    puts("-hugepages - allocate the iteration buffer with 2 MB pages (hugetlb, else transparent huge pages)");
+    puts("-pin compact|scatter|smt - pin threads (hyperthreads, cores, sockets order) and first touch their rows");
+    puts("-worker [host:]port - serve render requests from a coordinator");
+    puts("-coordinator host:port,... - render the frame in strips on workers, with retries");
+    puts("-tile rows - rows per strip (even); default 64");
+    puts("-daemon socket - serve render jobs (command line parameters, one per line) on a unix socket");
+    puts("-state file - save the unresolved pixels, a later run with a larger -i resumes only them");
+    puts("-checkpoint file - render in -tile strips, save finished strips asynchronously to file");
+    puts("-resume - with -checkpoint, reload the finished strips and render the others");
+    puts("-tiled file - write 256x256 tiles and a pyramid of levels to file, band by band, instead of -pgm/-xpm");
+    puts("-compress - with -tiled, zlib compress the tiles");
+    puts("-extract file level,x,y,w,h - write a region of a tiled file level as extract.pgm");
+    puts("-pipeline - compute -tile strips while an encoder thread writes the previous ones (range 0..maxiters)");
+    puts("-compact - keep the counts as constant, delta bit-packed or raw 64x64 tiles, -pgm decoded from them");
+    puts("-shm name - publish -tile strips into the shared memory ring /name instead of -pgm/-xpm/-png");
+    puts("-shm-read name - wait for the next complete frame of the ring /name, write it as name.pgm");
+    puts("-symmetry - compute rows mirrored about Im=0 once and copy them");
+    puts("-aa samples - re-sample edge pixels with samples (4, 9, 16...) jittered points and average them");
+    puts("-aa-edge diff - count difference to a neighbour which makes an edge pixel; default 1");
+    puts("-mixed - recompute edge pixels and pixels escaping near maxiters in double");
+    puts("-area samples - estimate the area of the set from random points (-i, -t), through the query kernels");
+    puts("-query file - print the counts of the \"re im\" points listed in file");
+    puts("-buddhabrot samples - accumulate the orbits of escaping random points over the window, buddhabrot.pgm");
+    puts("-anti - with -buddhabrot, accumulate the orbits of the points which do not escape instead");
+    puts("-distance - render the distance estimate to the set (dz/dc kernels) as a float pfm, shaded with -pgm");
+    puts("-progress - report rows done, Mpixel/s, Giter/s and ETA on stderr while rendering; SIGINT cancels");
+    puts("-autotune - benchmark all procedures and save the fastest in the config file");
+    puts("-config file - config file; default ~/.fractal64/<hostname>-<program>.conf");
     exit(EXIT_FAILURE);
 }
 
@@ -259,12 +522,14 @@ main(int argc, char *argv[])
 
     int i, j;
     uint32_t t1, t2;
-    void (*function) (float Re_min, float Re_max, float Im_min, float Im_max,
-                      float threshold, int maxiters, int width, int height, uint16_t * data) = FPU_mandelbrot;
+    mandelbrot_fn function = FPU_mandelbrot;
+    const struct procedure *proc = NULL;
+    struct config cfg;
 
     // parameters
     char image_name[256];
-    uint16_t *ptr;
+    size_t pos;
+    int elem = 0;
     char *function_name = "FPU";
     unsigned height = 512;
     unsigned width = 512;
@@ -274,6 +539,48 @@ main(int argc, char *argv[])
     unsigned maxiters = 255;
     unsigned xpm = 0;
     unsigned pgm = 0;
+    unsigned tune = 0;
+    unsigned use_mmap = 0;
+    unsigned direct = 0;
+    unsigned stream = 0;
+    unsigned huge = 0;
+    struct frame_buffer fb = { NULL, 0, "static" };
+    enum pin_policy pin = PIN_NONE;
+    const char *worker = NULL;
+    const char *coordinator = NULL;
+    const char *daemon_path = NULL;
+    const char *state_path = NULL;
+    mandelbrot_points_fn state_function = points_function;
+    const char *state_name = points_name;
+    const char *checkpoint_path = NULL;
+    unsigned resume = 0;
+    const char *tiled_path = NULL;
+    const char *extract_path = NULL;
+    const char *extract_spec = NULL;
+    unsigned compress = 0;
+    unsigned pipeline = 0;
+    unsigned png = 0;
+    unsigned symmetry = 0;
+    unsigned compact = 0;
+    unsigned progress = 0;
+    const char *shm_name = NULL;
+    const char *shm_read_name = NULL;
+    unsigned distance = 0;
+    int aa = 0;
+    unsigned mixed = 0;
+    size_t area = 0;
+    const char *query_path = NULL;
+    size_t buddhabrot = 0;
+    unsigned anti = 0;
+    unsigned aa_edge = 1;
+    int tile_rows = 64;
+    int tile_set = 0;
+    const char *pin_name = NULL;
+    struct mapped_pgm out;
+    void *frame = image;
+    char config_path[PATH_MAX];
+
+    config_default_path(config_path, sizeof(config_path), argv[0]);
 
     if (argc == 1) {
         help(argv[0]);
@@ -286,39 +593,10 @@ main(int argc, char *argv[])
             function_name = str;
 
             // 1. function name
-            if (strcasecmp(str, "ORIG") == 0)
-                function = ORIG_mandelbrot;
-
-            else if (strcasecmp(str, "FPU") == 0)
-                function = FPU_mandelbrot;
-
-#if defined(SSE4)
-            else if (strcasecmp(str, "SSE") == 0)
-                function = SSE_mandelbrot;
-#endif
-
-#if defined(AVX2)
-            else if (strcasecmp(str, "AVX2") == 0)
-                function = AVX2_mandelbrot;
-#if defined(FMA)
-            else if (strcasecmp(str, "AVX2+FMA") == 0)
-                function = AVX2_FMA_mandelbrot;
-            else if (strcasecmp(str, "AVX2+FMA+STITCH") == 0)
-                function = AVX2_FMA_STITCH_mandelbrot;
-#endif
-#endif
-#if defined(AVX512)
-            else if (strcasecmp(str, "AVX512") == 0)
-                function = AVX512_mandelbrot;
-#if defined(FMA)
-            else if (strcasecmp(str, "AVX512+FMA") == 0)
-                function = AVX512_FMA_mandelbrot;
-            else if (strcasecmp(str, "AVX512+FMA+STITCH") == 0)
-                function = AVX512_FMA_STITCH_mandelbrot;
-#endif
-#endif
-            else
+            proc = find_procedure(str);
+            if (!proc)
                 help(argv[0]);
+            function = proc->function;
 
             continue;
         }
@@ -352,6 +630,12 @@ main(int argc, char *argv[])
             continue;
         }
 
+        if (!strcmp(argv[i], "-julia")) {
+            julia_Cre = atof(argv[++i]);
+            julia_Cim = atof(argv[++i]);
+            continue;
+        }
+
         if (!strcmp(argv[i], "-i")) {
             maxiters = atoi(argv[++i]);
             continue;
@@ -367,13 +651,172 @@ main(int argc, char *argv[])
             continue;
         }
 
+        if (!strcmp(argv[i], "-png")) {
+            png = 1;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-bits")) {
+            elem = atoi(argv[++i]) / 8;
+            if (elem != ELEM_U8 && elem != ELEM_U16 && elem != ELEM_U32)
+                die("iteration buffer width (-bits) must be 8, 16 or 32");
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-mmap")) {
+            use_mmap = 1;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-stream")) {
+            stream = 1;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-hugepages")) {
+            huge = 1;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-pin")) {
+            pin_name = argv[++i];
+            pin = pin_policy_parse(pin_name);
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-worker")) {
+            worker = argv[++i];
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-coordinator")) {
+            coordinator = argv[++i];
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-daemon")) {
+            daemon_path = argv[++i];
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-tile")) {
+            tile_rows = atoi(argv[++i]);
+            tile_set = 1;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-state")) {
+            state_path = argv[++i];
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-checkpoint")) {
+            checkpoint_path = argv[++i];
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-resume")) {
+            resume = 1;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-tiled")) {
+            tiled_path = argv[++i];
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-compress")) {
+            compress = 1;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-extract")) {
+            extract_path = argv[++i];
+            extract_spec = argv[++i];
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-pipeline")) {
+            pipeline = 1;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-progress")) {
+            progress = 1;
+            continue;
+        }
+        if (!strcmp(argv[i], "-shm")) {
+            shm_name = argv[++i];
+            continue;
+        }
+        if (!strcmp(argv[i], "-shm-read")) {
+            shm_read_name = argv[++i];
+            continue;
+        }
+        if (!strcmp(argv[i], "-compact")) {
+            compact = 1;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-symmetry")) {
+            symmetry = 1;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-aa")) {
+            aa = atoi(argv[++i]);
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-aa-edge")) {
+            aa_edge = atoi(argv[++i]);
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-mixed")) {
+            mixed = 1;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-area")) {
+            area = strtoull(argv[++i], NULL, 10);
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-query")) {
+            query_path = argv[++i];
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-buddhabrot")) {
+            buddhabrot = strtoull(argv[++i], NULL, 10);
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-anti")) {
+            anti = 1;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-distance")) {
+            distance = 1;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-autotune")) {
+            tune = 1;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-config")) {
+            snprintf(config_path, sizeof(config_path), "%s", argv[++i]);
+            continue;
+        }
+
         printf("%s ????\n", argv[i]);
         die("unknown parameter on command line");
     }
 
-    if (width * height > WIDTH * HEIGHT) {
-        die("width*height (-w, -h) must be less than 8192*8192");
-    }
     if (width % 16) {
         die("width (-w) must be a multiple of 16");
     }
@@ -389,25 +832,219 @@ main(int argc, char *argv[])
     if (threshold <= 1) {
         die("threshold (-t) must be greater than 1");
     }
+    if (tile_rows <= 0 || tile_rows % 2) {
+        die("tile rows (-tile) must be even");
+    }
+    if (tiled_path && (xpm || pgm || png)) {
+        die("-tiled replaces the -pgm, -xpm and -png outputs");
+    }
+    if (pipeline && png) {
+        die("-png needs the whole frame, it cannot be used with -pipeline");
+    }
+    if (pipeline && !pgm && !xpm) {
+        die("-pipeline encodes the strips to -pgm and/or -xpm, select at least one");
+    }
+    if (pipeline && (tiled_path || state_path || checkpoint_path || coordinator || symmetry)) {
+        die("-pipeline renders its own strips, it cannot be used with -tiled, -state, -checkpoint, -coordinator "
+            "or -symmetry");
+    }
+    if (distance && (xpm || png)) {
+        die("-distance writes a pfm and, with -pgm, a pgm");
+    }
+    if (use_mmap && (tiled_path || pipeline || distance || compact || shm_name)) {
+        die("-mmap maps the frame pgm, -tiled, -pipeline, -distance, -compact and -shm write their own output");
+    }
+    if (compact && (xpm || png || tiled_path || pipeline || distance)) {
+        die("-compact writes only -pgm, it cannot be used with -xpm, -png, -tiled, -pipeline or -distance");
+    }
+    if (shm_name && (xpm || pgm || png || tiled_path || pipeline || distance || compact || state_path
+                     || checkpoint_path || coordinator || symmetry)) {
+        die("-shm publishes -tile strips only, it cannot be used with other outputs or render modes");
+    }
+    if (symmetry && (checkpoint_path || state_path || coordinator || tiled_path || compact || pipeline || distance)) {
+        die("-symmetry mirrors rows of the whole frame, it cannot be used with -checkpoint, -state, -coordinator, "
+            "-tiled, -compact, -pipeline or -distance");
+    }
+    if (aa && (aa < 4 || lround(sqrt(aa)) * lround(sqrt(aa)) != aa)) {
+        die("-aa samples must be a square, 4 or more");
+    }
+    if (aa && (tiled_path || pipeline || distance || compact || shm_name)) {
+        die("-aa needs the whole frame of counts, it cannot be used with -tiled, -pipeline, -distance, -compact or -shm");
+    }
+    if (mixed && (tiled_path || pipeline || distance || compact || shm_name)) {
+        die("-mixed needs the whole frame of counts, it cannot be used with -tiled, -pipeline, -distance, -compact or -shm");
+    }
+
+    if (proc && proc->fractal != FRACTAL_MANDELBROT
+        && (distance || aa || mixed || state_path || coordinator || worker)) {
+        die("%s: -distance, -aa, -mixed, -state, -coordinator and -worker use Mandelbrot kernels", proc->name);
+    }
+    if (state_path && proc && !(state_function = points_select(proc->name, &state_name))) {
+        die("%s has no point list procedure, -state runs the FPU, AVX2+FMA or AVX512+FMA ones of this binary",
+            proc->name);
+    }
+    if (proc && proc->fractal == FRACTAL_JULIA && symmetry) {
+        die("%s: Julia sets are symmetric about 0, not about Im=0 (-symmetry)", proc->name);
+    }
+
+    if (extract_path) {
+        tiled_extract(extract_path, extract_spec);
+        return 0;
+    }
+
+    if (area) {
+        query_area(area, threshold, maxiters);
+        return 0;
+    }
+
+    if (query_path) {
+        query_file(query_path, threshold, maxiters);
+        return 0;
+    }
+
+    if (shm_read_name) {
+        shm_read(shm_read_name);
+        return 0;
+    }
+
+    if (buddhabrot) {
+        printf("Buddhabrot %d x %d, Area [(%0.5f,%0.5f), (%0.5f, %0.5f)], threshold=%0.2f, maxiters=%d",
+               width, height, Re_min, Im_min, Re_max, Im_max, threshold, maxiters);
+        buddhabrot_render(anti ? "anti-buddhabrot" : "buddhabrot", buddhabrot, anti, Re_min, Re_max, Im_min, Im_max,
+                          threshold, maxiters, width, height);
+        return 0;
+    }
+
+    topology_discover();
+
+    if (tune) {
+        autotune(config_path, image);
+        return 0;
+    }
+
+    // no explicit procedure, use the tuned one for this host if any
+    if (!proc && config_load(config_path, &cfg)) {
+        proc = find_procedure(cfg.procedure);
+        if (proc) {
+            function = proc->function;
+            function_name = (char *) proc->name;
+            config_apply(&cfg);
+            // the tuned band height, unless -tile chose one
+            if (!tile_set && cfg.tile)
+                tile_rows = cfg.tile;
+            printf("Config %s: %s threads=%d pin=%s tile=%d\n", config_path, cfg.procedure, cfg.threads,
+                   pin_names[cfg.pin], tile_rows);
+            // the tuned placement, unless -pin chose one; pinned again below to first touch the frame
+            if (!pin && cfg.pin) {
+                pin = cfg.pin;
+                pin_name = pin_names[pin];
+            }
+        }
+    }
+
+    if (worker) {
+        worker_serve(worker);
+        return 0;
+    }
+
+    if (daemon_path) {
+        if (pin) {
+            pin_threads(pin);
+            print_placement(pin_name);
+        }
+        daemon_serve(daemon_path, function, function_name);
+        return 0;
+    }
+
+    if (!elem)
+        elem = elem_for_maxiters(maxiters);
+    if (stream)
+        elem |= ELEM_STREAM;
 
     // print summary
-    printf("Image %d x %d, Area [(%0.5f,%0.5f), (%0.5f, %0.5f)], threshold=%0.2f, maxiters=%d\n",
-           width, height, Re_min, Im_min, Re_max, Im_max, threshold, maxiters);
+    printf("Image %d x %d, Area [(%0.5f,%0.5f), (%0.5f, %0.5f)], threshold=%0.2f, maxiters=%d, u%d%s\n",
+           width, height, Re_min, Im_min, Re_max, Im_max, threshold, maxiters, ELEM_SIZE(elem) * 8,
+           stream ? " stream" : "");
+    if (proc && proc->fractal == FRACTAL_JULIA)
+        printf("Julia c = %0.5f%+0.5fi\n", julia_Cre, julia_Cim);
+
+    // u8 counts need no normalization, the procedure renders into the file
+    if (pgm && use_mmap && ELEM_SIZE(elem) == ELEM_U8) {
+        sprintf(image_name, "%s.pgm", function_name);
+        if (!pgm_map(&out, image_name, width, height, maxiters < 1 ? 1 : maxiters > 255 ? 255 : maxiters, 1))
+            die("cannot map %s", image_name);
+        frame = out.pixels;
+        direct = 1;
+    } else if (tiled_path || pipeline || distance || compact || shm_name) {
+        frame = NULL;           // bands or strips only, or no counts
+    } else if (huge || (size_t) width * height * ELEM_SIZE(elem) > sizeof(image)) {
+        if (!frame_alloc(&fb, (size_t) width * height * ELEM_SIZE(elem), huge))
+            die("cannot allocate %u x %u frame", width, height);
+        frame = fb.data;
+        printf("Frame %zu bytes, %s\n", fb.len, fb.kind);
+    }
+
+    if (pin) {
+        pin_threads(pin);
+        print_placement(pin_name);
+        if (frame)
+            first_touch(frame, width, height, elem);
+    }
 
-    printf("%s ", function_name);
+    printf("%s ", distance ? distance_name : function_name);
     fflush(stdout);
+    progress_start(width, height, progress);
     t1 = get_time();
-    function(Re_min, Re_max, Im_min, Im_max, threshold, maxiters, width, height, image);
+    if (distance)
+        distance_render(Re_min, Re_max, Im_min, Im_max, threshold, maxiters, width, height);
+    else if (pipeline)
+        pipeline_render(function, function_name, pgm, xpm, Re_min, Re_max, Im_min, Im_max, threshold, maxiters,
+                        width, height, tile_rows, elem);
+    else if (compact)
+        compact_render(function, function_name, pgm, Re_min, Re_max, Im_min, Im_max, threshold, maxiters, width,
+                       height, elem);
+    else if (shm_name)
+        shm_render(shm_name, function, Re_min, Re_max, Im_min, Im_max, threshold, maxiters, width, height,
+                   tile_rows, elem);
+    else if (state_path)
+        state_render(state_path, state_function, state_name, Re_min, Re_max, Im_min, Im_max, threshold, maxiters,
+                     width, height, elem, frame);
+    else if (tiled_path)
+        tiled_render(tiled_path, compress, function, Re_min, Re_max, Im_min, Im_max, threshold, maxiters, width,
+                     height, elem);
+    else if (checkpoint_path)
+        checkpoint_render(checkpoint_path, resume, function, proc ? proc->name : function_name, Re_min, Re_max,
+                          Im_min, Im_max, threshold, maxiters, width, height, tile_rows, elem, frame);
+    else if (coordinator)
+        coordinator_render(coordinator, function_name, Re_min, Re_max, Im_min, Im_max, threshold, maxiters,
+                           width, height, tile_rows, elem, frame);
+    else if (symmetry)
+        symmetry_render(function, Re_min, Re_max, Im_min, Im_max, threshold, maxiters, width, height, elem, frame);
+    else
+        function(Re_min, Re_max, Im_min, Im_max, threshold, maxiters, width, height, 0, height, elem, frame);
+    if (mixed && frame && !render_cancelled())
+        mixed_refine(Re_min, Re_max, Im_min, Im_max, threshold, maxiters, width, height, elem, frame);
+    if (aa && frame && !render_cancelled())
+        aa_refine(aa, aa_edge, Re_min, Re_max, Im_min, Im_max, threshold, maxiters, width, height, elem, frame);
     t2 = get_time();
+    progress_stop();
+    if (render_cancelled()) {
+        if (direct)
+            unlink(image_name);         // u8 counts were rendered straight into the pgm
+        die("\ncancelled after %u us", t2 - t1);
+    }
     printf("%d us\n", t2 - t1);
 
-    if (xpm || pgm) {
+    if (distance)
+        distance_write(distance_name, pgm, width, height);
+
+    if ((xpm || pgm || png) && frame) {
         unsigned miniters = maxiters + 2;
         maxiters = 0;
-        ptr = image;
+        pos = 0;
         i = height * width;
         while (i--) {
-           unsigned pix = *ptr++;
+           unsigned pix = load_iters(frame, pos++, elem);
            maxiters = pix > maxiters ? pix : maxiters;   
            miniters = pix < miniters ? pix : miniters;   
 	}
@@ -430,13 +1067,13 @@ main(int argc, char *argv[])
                     char c2 = 'a' + (i % 25);
                     fprintf(f, "\"%c%c c #%2.2x%2.2x%2.2x\",\n", c1, c2, r, g, b);
                 }
-                ptr = image;
+                pos = 0;
                 i = height;
                 while (i--) {
                     j = width;
                     fprintf(f, "\"");
                     while (j--) {
-                        double pixel = (double) (*ptr++ - miniters) / (double) (maxiters  - miniters + 1) * (double) maxcolors;
+                        double pixel = (double) (load_iters(frame, pos++, elem) - miniters) / (double) (maxiters  - miniters + 1) * (double) maxcolors;
                         int color = (int) pixel;
                         char c1 = 'a' + (color / 25);
                         char c2 = 'a' + (color % 25);
@@ -450,19 +1087,37 @@ main(int argc, char *argv[])
             }
         }
 
-        if (pgm)
+        if (png) {
+            sprintf(image_name, "%s.png", function_name);
+            png_write(image_name, frame, elem, width, height, miniters, maxiters, tile_rows);
+        }
+
+        if (pgm && direct) {
+            pgm_unmap(&out);
+        } else if (pgm && use_mmap) {
+            // save pgm image, normalized into the mapped file
+            sprintf(image_name, "%s.pgm", function_name);
+            if (pgm_map(&out, image_name, width, height, 255, 0)) {
+                i = height * width;
+                for (pos = 0; pos < (size_t) i; pos++) {
+                    double pixel = (double) (load_iters(frame, pos, elem) - miniters) / (double) (maxiters - miniters + 1) * (double) 255;
+                    out.pixels[pos] = (char) pixel;
+                }
+                pgm_unmap(&out);
+            }
+        } else if (pgm)
         {
             // save pgm image
             sprintf(image_name, "%s.pgm", function_name);
             f = fopen(image_name, "wb");
             if (f) {
                 fprintf(f, "P5\n%d %d\n255\n", width, height);
-                ptr = image;
+                pos = 0;
                 i = height;
                 while (i--) {
                     j = width;
                     while (j--) {
-                        double pixel = (double) (*ptr++ - miniters) / (double) (maxiters - miniters + 1) * (double) 255;
+                        double pixel = (double) (load_iters(frame, pos++, elem) - miniters) / (double) (maxiters - miniters + 1) * (double) 255;
                         char color = (char) pixel;
                         fwrite(&color, 1, 1, f);
 		    }
@@ -471,5 +1126,7 @@ main(int argc, char *argv[])
             }
         }
     }
+    if (fb.data)
+        frame_free(&fb);
     return 0;
 }
@@ -0,0 +1,112 @@
+//=== Mixed precision ====================================================
+//
+// -mixed renders the frame with the selected float procedure (a STITCH one
+// for speed), then recomputes in double only the pixels the float counts
+// are least sure about: those whose count differs from one of their 8
+// neighbours by more than MIXED_EDGE, where rounding moves the boundary,
+// and those which escape within the last maxiters / MIXED_NEAR iterations,
+// where float orbits have drifted the most.  Interior pixels away from the
+// boundary, the most expensive ones, are not recomputed.
+//
+// Flagged pixels go through the double point list kernels MIXED_BATCH at
+// a time, in parallel chunks, with their c computed in double from the
+// window.
+
+#define MIXED_EDGE  1
+#define MIXED_NEAR  8
+#define MIXED_BATCH 65536
+#define MIXED_PAD   8           // lanes of the widest double kernel
+
+typedef void (*mandelbrot_points_double_fn) (float threshold, int iters, int n, const double *Cre,
+                                             const double *Cim, uint32_t *count);
+
+#if defined(AVX512) && defined(FMA)
+static const mandelbrot_points_double_fn mixed_function = AVX512_FMA_mandelbrot_points_double;
+static const char *mixed_name = "AVX512+FMA";
+#elif defined(AVX2) && defined(FMA)
+static const mandelbrot_points_double_fn mixed_function = AVX2_FMA_mandelbrot_points_double;
+static const char *mixed_name = "AVX2+FMA";
+#else
+static const mandelbrot_points_double_fn mixed_function = FPU_mandelbrot_points_double;
+static const char *mixed_name = "FPU";
+#endif
+
+void
+mixed_refine(float Re_min, float Re_max, float Im_min, float Im_max, float threshold, int maxiters, int width,
+             int height, int elem, void *data)
+{
+    double dRe = ((double) Re_max - Re_min) / width;
+    double dIm = ((double) Im_max - Im_min) / height;
+    unsigned near = maxiters - maxiters / MIXED_NEAR;
+    size_t npix = (size_t) width * height, nflag = 0, changed = 0, pos, b, k;
+    unsigned char *flag = malloc(npix);
+    double *Cre = aligned_alloc(64, MIXED_BATCH * sizeof(double));
+    double *Cim = aligned_alloc(64, MIXED_BATCH * sizeof(double));
+    uint32_t *count = aligned_alloc(64, MIXED_BATCH * sizeof(uint32_t));
+    size_t *list;
+    uint32_t t1 = get_time(), t2;
+
+    if (!flag || !Cre || !Cim || !count)
+        die("mixed: out of memory");
+
+    aa_edges(data, elem, width, height, MIXED_EDGE, flag);
+#if defined(_OPENMP)
+#pragma omp parallel for reduction(+:nflag)
+#endif
+    for (pos = 0; pos < npix; pos++) {
+        unsigned c = load_iters(data, pos, elem);
+
+        flag[pos] |= c >= near && c < (unsigned) maxiters;
+        nflag += flag[pos];
+    }
+    t2 = get_time();
+
+    list = malloc((nflag ? nflag : 1) * sizeof(*list));
+    if (!list)
+        die("mixed: out of memory");
+    for (pos = 0, k = 0; pos < npix; pos++)
+        if (flag[pos])
+            list[k++] = pos;
+    free(flag);
+
+    for (b = 0; b < nflag; b += MIXED_BATCH) {
+        size_t m = nflag - b < MIXED_BATCH ? nflag - b : MIXED_BATCH;
+        size_t size = (m + MIXED_PAD - 1) / MIXED_PAD * MIXED_PAD;
+        long i;
+
+        for (k = 0; k < m; k++) {
+            Cre[k] = Re_min + (double) (list[b + k] % width) * dRe;
+            Cim[k] = Im_min + (double) (list[b + k] / width) * dIm;
+        }
+        // padding escapes before the first iteration
+        for (; k < size; k++)
+            Cre[k] = Cim[k] = FLT_MAX;
+
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for (i = 0; i < (long) size; i += POINTS_CHUNK) {
+            int len = size - i < POINTS_CHUNK ? size - i : POINTS_CHUNK;
+
+            mixed_function(threshold, maxiters, len, Cre + i, Cim + i, count + i);
+        }
+
+#if defined(_OPENMP)
+#pragma omp parallel for reduction(+:changed)
+#endif
+        for (i = 0; i < (long) m; i++) {
+            unsigned old = load_iters(data, list[b + i], elem);
+
+            store_iters((char *) data + list[b + i] * ELEM_SIZE(elem), elem, count[i]);
+            changed += load_iters(data, list[b + i], elem) != old;
+        }
+    }
+
+    printf("\n  mixed: %zu pixels recomputed in double with %s (%.1f %%), %zu changed, flag %u us, double %u us\n",
+           nflag, mixed_name, 100.0 * nflag / npix, changed, t2 - t1, get_time() - t2);
+
+    free(list);
+    free(Cre);
+    free(Cim);
+    free(count);
+}
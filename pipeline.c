@@ -0,0 +1,265 @@
+//=== Compute/encode pipeline ============================================
+//
+// -pipeline renders the frame in strips of -tile rows into PIPE_BUFFERS
+// strip buffers: while the procedure (and its openmp threads) computes strip
+// N+1, an encoder thread normalizes, colours and writes strip N.  Buffers
+// go back and forth through two single producer / single consumer lock-free
+// rings, full strips to the encoder and empty buffers back to compute.
+//
+// The frame min/max is not known before the last strip, so counts are
+// normalized on the fixed range [0, maxiters] instead.
+//
+// Both stages record when they were busy on each strip; the overlap
+// reported is the time both were busy at once.
+
+#define PIPE_BUFFERS 2          // double buffered
+#define PIPE_SLOTS   4          // ring size, power of two >= PIPE_BUFFERS + 1
+#define PIPE_SPINS   1000       // pause loops before sleeping in a wait
+
+struct strip {
+    int y0, rows;               // rows == 0 ends the frame
+    void *data;
+};
+
+struct busy {
+    uint32_t start, end;
+};
+
+struct strip_ring {
+    struct strip *slot[PIPE_SLOTS];
+    unsigned head __attribute__ ((aligned(64)));        // consumer
+    unsigned tail __attribute__ ((aligned(64)));        // producer
+};
+
+static int
+ring_push(struct strip_ring *r, struct strip *s)
+{
+    unsigned t = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+
+    if (t - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == PIPE_SLOTS)
+        return 0;
+    r->slot[t % PIPE_SLOTS] = s;
+    __atomic_store_n(&r->tail, t + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static struct strip *
+ring_pop(struct strip_ring *r)
+{
+    unsigned h = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    struct strip *s;
+
+    if (h == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    s = r->slot[h % PIPE_SLOTS];
+    __atomic_store_n(&r->head, h + 1, __ATOMIC_RELEASE);
+    return s;
+}
+
+// pop, spinning then sleeping; the time spent waiting is added to *waited
+static struct strip *
+ring_wait(struct strip_ring *r, uint32_t *waited)
+{
+    struct strip *s = ring_pop(r);
+    uint32_t t1;
+    int spins = 0;
+
+    if (s)
+        return s;
+    t1 = get_time();
+    while (!(s = ring_pop(r))) {
+        if (++spins < PIPE_SPINS)
+            _mm_pause();
+        else
+            usleep(20);
+    }
+    *waited += get_time() - t1;
+    return s;
+}
+
+static struct pipeline {
+    struct strip_ring full;     // compute -> encoder
+    struct strip_ring empty;    // encoder -> compute
+    FILE *pgm, *xpm;
+    int width, elem, maxcolors;
+    unsigned maxiters;
+    unsigned char *line;        // one encoded pgm strip
+    uint32_t encode_us, encode_wait_us;
+    struct busy *encode_busy;   // per strip, in frame order
+    int strips;
+} pipe_state;
+
+static void
+pipeline_encode(const struct strip *s)
+{
+    struct pipeline *p = &pipe_state;
+    size_t n = (size_t) s->rows * p->width, pos;
+    int x, y;
+
+    if (p->pgm) {
+        for (pos = 0; pos < n; pos++) {
+            double pixel = (double) load_iters(s->data, pos, p->elem) / (double) (p->maxiters + 1) * (double) 255;
+
+            p->line[pos] = (unsigned char) pixel;
+        }
+        fwrite(p->line, 1, n, p->pgm);
+    }
+
+    if (p->xpm) {
+        for (pos = 0, y = 0; y < s->rows; y++) {
+            fputc('"', p->xpm);
+            for (x = 0; x < p->width; x++) {
+                double pixel = (double) load_iters(s->data, pos++, p->elem) / (double) (p->maxiters + 1) * (double) p->maxcolors;
+                int color = (int) pixel;
+
+                fputc('a' + (color / 25), p->xpm);
+                fputc('a' + (color % 25), p->xpm);
+            }
+            fputs("\",\n", p->xpm);
+        }
+    }
+}
+
+// time in both lists of busy intervals, each sorted and disjoint
+static uint32_t
+pipeline_overlap(const struct busy *a, int na, const struct busy *b, int nb)
+{
+    uint32_t both = 0;
+    int i = 0, j = 0;
+
+    while (i < na && j < nb) {
+        uint32_t start = a[i].start > b[j].start ? a[i].start : b[j].start;
+        uint32_t end = a[i].end < b[j].end ? a[i].end : b[j].end;
+
+        if (end > start)
+            both += end - start;
+        if (a[i].end < b[j].end)
+            i++;
+        else
+            j++;
+    }
+    return both;
+}
+
+static void *
+pipeline_encoder(void *arg)
+{
+    struct pipeline *p = &pipe_state;
+    struct strip *s;
+
+    (void) arg;
+    while ((s = ring_wait(&p->full, &p->encode_wait_us))->rows) {
+        uint32_t t1 = get_time();
+
+        pipeline_encode(s);
+        p->encode_busy[p->strips].start = t1;
+        p->encode_busy[p->strips].end = get_time();
+        p->encode_us += p->encode_busy[p->strips].end - t1;
+        p->strips++;
+        while (!ring_push(&p->empty, s))
+            _mm_pause();
+    }
+    return NULL;
+}
+
+void
+pipeline_render(mandelbrot_fn function, const char *name, int pgm, int xpm, float Re_min, float Re_max,
+                float Im_min, float Im_max, float threshold, unsigned maxiters, int width, int height, int tile_rows,
+                int elem)
+{
+    struct pipeline *p = &pipe_state;
+    struct strip strips[PIPE_BUFFERS + 1], *s;
+    size_t strip_bytes = ((size_t) tile_rows * width * ELEM_SIZE(elem) + 63) & ~(size_t) 63;
+    uint32_t t0, compute_us = 0, compute_wait_us = 0, wall_us, both_us;
+    int nstrips = (height + tile_rows - 1) / tile_rows, computed = 0;
+    struct busy *compute_busy = malloc(nstrips * sizeof(*compute_busy));
+    char pgm_name[256], xpm_name[256];
+    pthread_t encoder;
+    int i, y0;
+
+    memset(p, 0, sizeof(*p));
+    p->width = width;
+    p->elem = elem;
+    p->maxiters = maxiters;
+    p->maxcolors = 512;
+    p->line = malloc((size_t) tile_rows * width);
+    p->encode_busy = malloc(nstrips * sizeof(*p->encode_busy));
+    if (!p->line || !p->encode_busy || !compute_busy)
+        die("pipeline: out of memory");
+
+    if (pgm) {
+        sprintf(pgm_name, "%s.pgm", name);
+        p->pgm = fopen(pgm_name, "wb");
+        if (p->pgm)
+            fprintf(p->pgm, "P5\n%d %d\n255\n", width, height);
+    }
+    if (xpm) {
+        sprintf(xpm_name, "%s.xpm", name);
+        p->xpm = fopen(xpm_name, "wt");
+        if (p->xpm) {
+            fprintf(p->xpm, "/* XPM */\nstatic char * XFACE[] = {\n\"%u %u %u 2\",\n", width, height, p->maxcolors);
+            for (i = p->maxcolors; i--;) {
+                unsigned tt = make_color(i, p->maxcolors);
+
+                fprintf(p->xpm, "\"%c%c c #%2.2x%2.2x%2.2x\",\n", 'a' + (i / 25), 'a' + (i % 25), (tt >> 16) & 0xff,
+                        (tt >> 8) & 0xff, tt & 0xff);
+            }
+        }
+    }
+
+    for (i = 0; i < PIPE_BUFFERS; i++) {
+        strips[i].data = aligned_alloc(64, strip_bytes);
+        if (!strips[i].data)
+            die("pipeline: out of memory");
+        ring_push(&p->empty, &strips[i]);
+    }
+    strips[PIPE_BUFFERS].rows = 0;      // end of frame
+
+    t0 = get_time();
+    pthread_create(&encoder, NULL, pipeline_encoder, NULL);
+    for (y0 = 0; y0 < height && !render_cancelled(); y0 += tile_rows) {
+        s = ring_wait(&p->empty, &compute_wait_us);
+        s->y0 = y0;
+        s->rows = y0 + tile_rows < height ? tile_rows : height - y0;
+
+        compute_busy[computed].start = get_time();
+        function(Re_min, Re_max, Im_min, Im_max, threshold, maxiters, width, height, y0, s->rows, elem, s->data);
+        compute_busy[computed].end = get_time();
+        compute_us += compute_busy[computed].end - compute_busy[computed].start;
+        computed++;
+
+        while (!ring_push(&p->full, s))
+            _mm_pause();
+    }
+    while (!ring_push(&p->full, &strips[PIPE_BUFFERS]))
+        _mm_pause();
+    pthread_join(encoder, NULL);
+
+    if (p->pgm)
+        fclose(p->pgm);
+    if (p->xpm) {
+        fprintf(p->xpm, "};\n");
+        fclose(p->xpm);
+    }
+    wall_us = get_time() - t0;
+
+    // the headers announce the whole frame, drop the partial images
+    if (render_cancelled()) {
+        if (p->pgm)
+            unlink(pgm_name);
+        if (p->xpm)
+            unlink(xpm_name);
+    }
+
+    both_us = pipeline_overlap(compute_busy, computed, p->encode_busy, p->strips);
+    printf("\n  pipeline: %d strips, compute %u us (waited %u us), encode %u us (waited %u us), wall %u us\n"
+           "  pipeline: overlap %u us (both busy), compute only %u us, encode only %u us\n", p->strips, compute_us,
+           compute_wait_us, p->encode_us, p->encode_wait_us, wall_us, both_us, compute_us - both_us,
+           p->encode_us - both_us);
+
+    for (i = 0; i < PIPE_BUFFERS; i++)
+        free(strips[i].data);
+    free(compute_busy);
+    free(p->encode_busy);
+    free(p->line);
+}
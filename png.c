@@ -0,0 +1,160 @@
+//=== Parallel png output ================================================
+//
+// -png writes the normalized frame as an 8-bit greyscale png.  Rows are
+// normalized and filtered (Sub) in parallel, then each strip of -tile rows
+// is deflated on its own thread, primed with the last 32 KB of the previous
+// strip as dictionary.  Strips end with Z_SYNC_FLUSH (byte aligned, not
+// final), the last one with Z_FINISH, so their raw deflate streams simply
+// concatenate; the zlib header goes in front and the adler32 of the whole
+// image, combined from the per-strip checksums, at the end.
+
+#define PNG_WINDOW 32768
+
+struct png_strip {
+    unsigned char *z;
+    size_t zlen;
+    uLong adler;
+};
+
+static void
+png_be32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+// a chunk from up to three parts, empty parts are skipped
+static void
+png_chunk(FILE *f, const char *type, const unsigned char *head, size_t hlen, const unsigned char *data, size_t len,
+          const unsigned char *tail, size_t tlen)
+{
+    const unsigned char *part[3] = { head, data, tail };
+    size_t plen[3] = { hlen, len, tlen };
+    unsigned char b[4];
+    uLong crc = crc32(0, (const Bytef *) type, 4);
+    int i;
+
+    png_be32(b, hlen + len + tlen);
+    fwrite(b, 1, 4, f);
+    fwrite(type, 1, 4, f);
+    for (i = 0; i < 3; i++) {
+        if (!plen[i])
+            continue;
+        fwrite(part[i], 1, plen[i], f);
+        crc = crc32(crc, part[i], plen[i]);
+    }
+    png_be32(b, crc);
+    fwrite(b, 1, 4, f);
+}
+
+void
+png_write(const char *name, const void *frame, int elem, unsigned width, unsigned height, unsigned miniters,
+          unsigned maxiters, int tile_rows)
+{
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    static const unsigned char zlib_header[2] = { 0x78, 0x01 };
+    size_t stride = (size_t) width + 1;         // filter byte + pixels
+    int nstrips = (height + tile_rows - 1) / tile_rows;
+    struct png_strip *strips = calloc(nstrips, sizeof(*strips));
+    unsigned char *raw = malloc(stride * height);
+    unsigned char ihdr[13], trailer[4];
+    uLong adler = adler32(0, NULL, 0);
+    size_t total = 0;
+    uint32_t t1 = get_time();
+    int y, s, failed = 0;
+    FILE *f;
+
+    if (!strips || !raw)
+        die("png: out of memory");
+
+    // normalize like the pgm output, Sub filter
+#if defined(_OPENMP)
+#pragma omp parallel for
+#endif
+    for (y = 0; y < (int) height; y++) {
+        unsigned char *row = raw + y * stride;
+        size_t pos = (size_t) y * width;
+        unsigned x, prev = 0;
+
+        row[0] = 1;
+        for (x = 0; x < width; x++) {
+            double pixel = (double) (load_iters(frame, pos + x, elem) - miniters) / (double) (maxiters - miniters + 1) * (double) 255;
+            unsigned grey = (unsigned char) pixel;
+
+            row[1 + x] = grey - prev;
+            prev = grey;
+        }
+    }
+
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic) reduction(|:failed)
+#endif
+    for (s = 0; s < nstrips; s++) {
+        size_t y0 = (size_t) s * tile_rows;
+        size_t rows = y0 + tile_rows < height ? (size_t) tile_rows : height - y0;
+        const unsigned char *in = raw + y0 * stride;
+        size_t len = rows * stride;
+        z_stream zs;
+
+        memset(&zs, 0, sizeof(zs));
+        if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            failed = 1;
+            continue;
+        }
+        if (s) {
+            size_t dict = y0 * stride < PNG_WINDOW ? y0 * stride : PNG_WINDOW;
+
+            deflateSetDictionary(&zs, in - dict, dict);
+        }
+
+        // room for the sync flush marker and the final block
+        strips[s].z = malloc(deflateBound(&zs, len) + 16);
+        zs.next_in = (Bytef *) in;
+        zs.avail_in = len;
+        zs.next_out = strips[s].z;
+        zs.avail_out = deflateBound(&zs, len) + 16;
+        if (!strips[s].z || deflate(&zs, s == nstrips - 1 ? Z_FINISH : Z_SYNC_FLUSH) == Z_STREAM_ERROR || zs.avail_in)
+            failed = 1;
+        strips[s].zlen = zs.total_out;
+        strips[s].adler = adler32(adler32(0, NULL, 0), in, len);
+        deflateEnd(&zs);
+    }
+    if (failed)
+        die("png: deflate failed");
+
+    for (s = 0; s < nstrips; s++) {
+        size_t y0 = (size_t) s * tile_rows;
+        size_t rows = y0 + tile_rows < height ? (size_t) tile_rows : height - y0;
+
+        adler = adler32_combine(adler, strips[s].adler, rows * stride);
+    }
+
+    f = fopen(name, "wb");
+    if (!f)
+        die("cannot write %s", name);
+    fwrite(signature, 1, 8, f);
+    png_be32(ihdr, width);
+    png_be32(ihdr + 4, height);
+    ihdr[8] = 8;                // bit depth
+    ihdr[9] = 0;                // greyscale
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+    png_chunk(f, "IHDR", NULL, 0, ihdr, 13, NULL, 0);
+
+    // one IDAT per strip, the zlib header and checksum ride on the first and last
+    png_be32(trailer, adler);
+    for (s = 0; s < nstrips; s++) {
+        png_chunk(f, "IDAT", zlib_header, s == 0 ? 2 : 0, strips[s].z, strips[s].zlen, trailer,
+                  s == nstrips - 1 ? 4 : 0);
+        total += strips[s].zlen;
+        free(strips[s].z);
+    }
+    png_chunk(f, "IEND", NULL, 0, NULL, 0, NULL, 0);
+    fclose(f);
+
+    printf("Png %s: %d strips, %zu bytes deflated from %zu, %u us\n", name, nstrips, total, stride * height,
+           get_time() - t1);
+    free(strips);
+    free(raw);
+}
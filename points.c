@@ -0,0 +1,109 @@
+//=== Point lists ========================================================
+//
+// the *_mandelbrot_points procedures iterate compacted lists of arbitrary
+// points (structure of arrays) instead of a window, each point resumes from
+// its own z and count.  Lists are padded to a multiple of 16 points with
+// points which escape at once.
+
+#include <float.h>
+
+#define POINTS_PAD   16
+#define POINTS_CHUNK 1024       // points per openmp work item
+
+#if defined(AVX512) && defined(FMA)
+static const mandelbrot_points_fn points_function = AVX512_FMA_mandelbrot_points;
+static const char *points_name = "AVX512+FMA";
+#elif defined(AVX2) && defined(FMA)
+static const mandelbrot_points_fn points_function = AVX2_FMA_mandelbrot_points;
+static const char *points_name = "AVX2+FMA";
+#else
+static const mandelbrot_points_fn points_function = FPU_mandelbrot_points;
+static const char *points_name = "FPU";
+#endif
+
+// point list procedure of the family of a window procedure (-p), NULL when
+// the binary has none for it
+static mandelbrot_points_fn
+points_select(const char *procedure, const char **name)
+{
+#if defined(AVX512) && defined(FMA)
+    if (!strncmp(procedure, "AVX512+FMA", 10)) {
+        *name = "AVX512+FMA";
+        return AVX512_FMA_mandelbrot_points;
+    }
+#endif
+#if defined(AVX2) && defined(FMA)
+    if (!strncmp(procedure, "AVX2+FMA", 8)) {
+        *name = "AVX2+FMA";
+        return AVX2_FMA_mandelbrot_points;
+    }
+#endif
+    if (!strcmp(procedure, "FPU") || !strcmp(procedure, "ORIG") || !strcmp(procedure, "FIXED")) {
+        *name = "FPU";
+        return FPU_mandelbrot_points;
+    }
+    return NULL;
+}
+
+struct points {
+    size_t n;                   // points in use
+    size_t size;                // allocated, multiple of POINTS_PAD
+    float *Cre, *Cim;
+    float *Zre, *Zim;
+    uint32_t *count;
+};
+
+int
+points_alloc(struct points *p, size_t n)
+{
+    size_t size = (n + POINTS_PAD - 1) / POINTS_PAD * POINTS_PAD;
+    size_t bytes = (size * sizeof(float) + 63) & ~(size_t) 63;
+    size_t k;
+
+    if (!size)
+        size = POINTS_PAD;
+    memset(p, 0, sizeof(*p));
+    p->n = n;
+    p->size = size;
+    p->Cre = aligned_alloc(64, bytes);
+    p->Cim = aligned_alloc(64, bytes);
+    p->Zre = aligned_alloc(64, bytes);
+    p->Zim = aligned_alloc(64, bytes);
+    p->count = aligned_alloc(64, bytes);
+    if (!p->Cre || !p->Cim || !p->Zre || !p->Zim || !p->count)
+        return 0;
+
+    // padding escapes before the first iteration
+    for (k = n; k < size; k++) {
+        p->Cre[k] = p->Cim[k] = 0;
+        p->Zre[k] = p->Zim[k] = FLT_MAX;
+        p->count[k] = 0;
+    }
+    return 1;
+}
+
+void
+points_free(struct points *p)
+{
+    free(p->Cre);
+    free(p->Cim);
+    free(p->Zre);
+    free(p->Zim);
+    free(p->count);
+}
+
+// at most iters more iterations for every point, in parallel chunks
+void
+points_run(mandelbrot_points_fn function, float threshold, int iters, struct points *p)
+{
+    long k;
+
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (k = 0; k < (long) p->size; k += POINTS_CHUNK) {
+        int len = p->size - k < POINTS_CHUNK ? p->size - k : POINTS_CHUNK;
+
+        function(threshold, iters, len, p->Cre + k, p->Cim + k, p->Zre + k, p->Zim + k, p->count + k);
+    }
+}
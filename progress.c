@@ -0,0 +1,126 @@
+//=== Progress and cancellation ==========================================
+//
+// -progress starts a reporter thread which sums the per-thread counters of
+// progress_rows() every PROGRESS_PERIOD_US and prints the rows done, the
+// current pixel and iteration rates and the time left at the average rate,
+// on stderr.  Counters are only added to by their thread, read by the
+// reporter, no locks on either side.
+//
+// SIGINT during the render sets render_cancel: the procedures skip their
+// remaining rows, a render stops after the row pairs in flight, and no
+// output is written; the files written during the render are deleted.  A
+// second SIGINT kills the process as usual.  The daemon cancels the job it
+// renders on SIGUSR1 and answers ERR cancelled.
+
+#include <signal.h>
+#include <unistd.h>
+
+#define PROGRESS_PERIOD_US 500000
+
+static struct progress {
+    pthread_t reporter;
+    int stop;
+    unsigned width, height;
+    uint32_t t0;
+} prog;
+
+static void
+progress_sum(uint64_t *rows, uint64_t *iters)
+{
+    int i;
+
+    *rows = *iters = 0;
+    for (i = 0; i < PROGRESS_SLOTS; i++) {
+        *rows += __atomic_load_n(&progress_count[i].rows, __ATOMIC_RELAXED);
+        *iters += __atomic_load_n(&progress_count[i].iters, __ATOMIC_RELAXED);
+    }
+}
+
+static void
+progress_print(uint64_t rows, double mpix, double giters, uint32_t now)
+{
+    double elapsed = (now - prog.t0) / 1e6;
+    double eta = rows ? elapsed * (prog.height - (double) rows) / rows : 0;
+
+    fprintf(stderr, "\r  progress: %5.1f%% %llu/%u rows, %.1f Mpix/s, %.2f Giter/s, %.1f s, ETA %.1f s  ",
+            100.0 * rows / prog.height, (unsigned long long) rows, prog.height, mpix, giters, elapsed,
+            eta > 0 ? eta : 0);
+}
+
+static void *
+progress_reporter(void *arg)
+{
+    uint64_t rows, iters, last_rows = 0, last_iters = 0;
+    uint32_t last = prog.t0, now;
+
+    (void) arg;
+    while (!__atomic_load_n(&prog.stop, __ATOMIC_ACQUIRE)) {
+        usleep(10000);
+        now = get_time();
+        if (now - last < PROGRESS_PERIOD_US)
+            continue;
+        progress_sum(&rows, &iters);
+        progress_print(rows, (double) (rows - last_rows) * prog.width / (now - last),
+                       (iters - last_iters) / ((now - last) * 1e3), now);
+        last = now;
+        last_rows = rows;
+        last_iters = iters;
+    }
+    return NULL;
+}
+
+static void
+progress_interrupt(int sig)
+{
+    (void) sig;
+    __atomic_store_n(&render_cancel, 1, __ATOMIC_RELAXED);
+}
+
+// catch sig (one shot unless again) to cancel renders
+void
+progress_catch(int sig, int again)
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = progress_interrupt;
+    sa.sa_flags = again ? SA_RESTART : SA_RESETHAND | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(sig, &sa, NULL);
+}
+
+void
+progress_start(unsigned width, unsigned height, int report)
+{
+    memset(progress_count, 0, sizeof(progress_count));
+    __atomic_store_n(&render_cancel, 0, __ATOMIC_RELAXED);
+    progress_catch(SIGINT, 0);
+
+    prog.width = width;
+    prog.height = height;
+    prog.stop = 0;
+    prog.t0 = get_time();
+    __atomic_store_n(&progress_on, report, __ATOMIC_RELEASE);
+    if (report)
+        pthread_create(&prog.reporter, NULL, progress_reporter, NULL);
+}
+
+void
+progress_stop(void)
+{
+    uint64_t rows, iters;
+    uint32_t now = get_time();
+
+    signal(SIGINT, SIG_DFL);
+    if (!__atomic_load_n(&progress_on, __ATOMIC_ACQUIRE))
+        return;
+    __atomic_store_n(&prog.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(prog.reporter, NULL);
+    __atomic_store_n(&progress_on, 0, __ATOMIC_RELEASE);
+
+    // averages over the whole render
+    progress_sum(&rows, &iters);
+    progress_print(rows, now - prog.t0 ? (double) rows * prog.width / (now - prog.t0) : 0,
+                   now - prog.t0 ? iters / ((now - prog.t0) * 1e3) : 0, now);
+    fputc('\n', stderr);
+}
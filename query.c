@@ -0,0 +1,139 @@
+//=== Point queries ======================================================
+//
+// mandelbrot_query() returns the escape counts (from z = c, as the window
+// procedures count) of arbitrary points given as two arrays, real and
+// imaginary parts.  Any n: the points are split in QUERY_CHUNK chunks over
+// the openmp threads, each run through the widest STITCH query kernel, and
+// only the last block of a chunk uses masked loads and stores.
+//
+// -area N estimates the area of the set from N random points, -query file
+// prints the counts of the "re im" points listed in file.
+
+#define QUERY_CHUNK 4096        // points per openmp work item, multiple of 32
+#define AREA_BATCH  (1 << 20)   // random points per query
+
+typedef void (*mandelbrot_query_fn) (float threshold, int maxiters, int n, const float *Cre, const float *Cim,
+                                     uint32_t *count);
+
+#if defined(AVX512) && defined(FMA)
+static const mandelbrot_query_fn query_function = AVX512_FMA_STITCH_mandelbrot_query;
+static const char *query_name = "AVX512+FMA+STITCH";
+#elif defined(AVX2) && defined(FMA)
+static const mandelbrot_query_fn query_function = AVX2_FMA_STITCH_mandelbrot_query;
+static const char *query_name = "AVX2+FMA+STITCH";
+#else
+static const mandelbrot_query_fn query_function = FPU_mandelbrot_query;
+static const char *query_name = "FPU";
+#endif
+
+void
+mandelbrot_query(float threshold, int maxiters, size_t n, const float *Cre, const float *Cim, uint32_t *count)
+{
+    long k;
+
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (k = 0; k < (long) n; k += QUERY_CHUNK) {
+        int len = n - k < QUERY_CHUNK ? n - k : QUERY_CHUNK;
+
+        query_function(threshold, maxiters, len, Cre + k, Cim + k, count + k);
+    }
+}
+
+// xorshift64*, one stream per point index so batches are reproducible
+static inline uint64_t
+area_random(uint64_t *s)
+{
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 0x2545f4914f6cdd1dULL;
+}
+
+// Monte Carlo estimate over [-2, 0.5] x [-1.25, 1.25], which holds the set
+void
+query_area(size_t samples, float threshold, int maxiters)
+{
+    const double Re_min = -2.0, Re_size = 2.5, Im_min = -1.25, Im_size = 2.5;
+    size_t batch = samples < AREA_BATCH ? samples : AREA_BATCH;
+    float *Cre = malloc(batch * sizeof(float));
+    float *Cim = malloc(batch * sizeof(float));
+    uint32_t *count = malloc(batch * sizeof(uint32_t));
+    size_t done, inside = 0;
+    uint32_t query_us = 0, t1;
+    double p, area;
+
+    if (!Cre || !Cim || !count)
+        die("area: out of memory");
+
+    for (done = 0; done < samples; done += batch) {
+        long m = samples - done < batch ? samples - done : batch, k;
+
+#if defined(_OPENMP)
+#pragma omp parallel for
+#endif
+        for (k = 0; k < m; k++) {
+            uint64_t s = (done + k + 1) * 0x9e3779b97f4a7c15ULL;
+            uint64_t r = area_random(&s);
+
+            Cre[k] = Re_min + Re_size * (double) (r >> 40) / (1 << 24);
+            Cim[k] = Im_min + Im_size * (double) (r & 0xffffff) / (1 << 24);
+        }
+
+        t1 = get_time();
+        mandelbrot_query(threshold, maxiters, m, Cre, Cim, count);
+        query_us += get_time() - t1;
+
+        for (k = 0; k < m; k++)
+            inside += count[k] >= (uint32_t) maxiters;
+    }
+
+    p = (double) inside / samples;
+    area = p * Re_size * Im_size;
+    printf("Area: %zu points, %zu inside after %d iterations, %.6f +- %.6f, %s %.1f Mpoints/s\n", samples, inside,
+           maxiters, area, sqrt(p * (1 - p) / samples) * Re_size * Im_size, query_name,
+           query_us ? (double) samples / query_us : 0.0);
+
+    free(Cre);
+    free(Cim);
+    free(count);
+}
+
+// "re im" per line in path, "re im count" per line on stdout
+void
+query_file(const char *path, float threshold, int maxiters)
+{
+    FILE *f = fopen(path, "rt");
+    size_t n = 0, size = 1024, k;
+    float *Cre = malloc(size * sizeof(float));
+    float *Cim = malloc(size * sizeof(float));
+    uint32_t *count;
+    float re, im;
+
+    if (!f)
+        die("cannot read %s", path);
+    while (Cre && Cim && fscanf(f, "%f %f", &re, &im) == 2) {
+        if (n == size) {
+            size *= 2;
+            Cre = realloc(Cre, size * sizeof(float));
+            Cim = realloc(Cim, size * sizeof(float));
+            if (!Cre || !Cim)
+                break;
+        }
+        Cre[n] = re;
+        Cim[n++] = im;
+    }
+    fclose(f);
+    count = malloc((n ? n : 1) * sizeof(uint32_t));
+    if (!Cre || !Cim || !count)
+        die("query: out of memory");
+
+    mandelbrot_query(threshold, maxiters, n, Cre, Cim, count);
+    for (k = 0; k < n; k++)
+        printf("%.9g %.9g %u\n", Cre[k], Cim[k], count[k]);
+
+    free(Cre);
+    free(Cim);
+    free(count);
+}
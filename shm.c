@@ -0,0 +1,276 @@
+//=== Shared memory ring =================================================
+//
+// -shm name publishes the frame, in strips of -tile rows, into the POSIX
+// shared memory object /name: a ring of SHM_SLOTS strip slots that viewers
+// and encoders map read only.  The procedure renders straight into a slot,
+// so a strip is neither copied nor written to a file, and a consumer reads
+// it in place without any system call.
+//
+// Single producer, any number of consumers, no locks: each slot has a
+// sequence number, odd while the producer writes the slot, 2 (n + 1) once
+// strip n is published in it, then head = n + 1.  A consumer reads strip n
+// when the sequence of its slot is 2 (n + 1), and keeps what it read only if
+// the sequence is still the same afterwards.  The producer never waits for
+// the consumers: a consumer more than SHM_SLOTS strips behind finds its
+// strips overwritten and drops them.
+//
+// The object is kept after the render, later renders with the same width,
+// element size and -tile continue its sequence, so a running consumer sees
+// the next frames; otherwise the old object is marked stale and replaced.
+// -shm-read name is a consumer: it writes the next complete frame as
+// name.pgm, normalized on [0, maxiters] like -pipeline.
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHM_MAGIC   0x4d485346u  // "FSHM"
+#define SHM_VERSION 1
+#define SHM_SLOTS   16
+#define SHM_PAGE    4096
+#define SHM_SPINS   1000        // pause loops before sleeping in a wait
+
+struct shm_slot {
+    uint64_t seq;               // odd while written, 2 (n + 1) once strip n is published
+    uint64_t frame;
+    uint32_t y0, rows, height, maxiters;
+    float Re_min, Re_max, Im_min, Im_max;
+} __attribute__ ((aligned(64)));
+
+struct shm_ring {
+    uint32_t magic, version;
+    uint32_t slots, width, elem, tile_rows;
+    uint64_t slot_bytes;        // page aligned strip payload
+    uint64_t data_offset;       // slot i payload at data_offset + i * slot_bytes
+    uint32_t stale;             // replaced by an object of another layout
+    uint64_t frames;            // frames started
+    uint64_t head __attribute__ ((aligned(64)));        // strips published
+    struct shm_slot slot[SHM_SLOTS];
+};
+
+static size_t
+shm_size(const struct shm_ring *r)
+{
+    return r->data_offset + r->slots * r->slot_bytes;
+}
+
+static void *
+shm_payload(struct shm_ring *r, uint64_t n)
+{
+    return (char *) r + r->data_offset + (n % r->slots) * r->slot_bytes;
+}
+
+// map /name for writing, reusing it when its layout matches
+static struct shm_ring *
+shm_create(const char *name, int width, int elem, int tile_rows, size_t *len)
+{
+    struct shm_ring want, *r;
+    struct stat st;
+    int fd;
+
+    memset(&want, 0, sizeof(want));
+    want.magic = SHM_MAGIC;
+    want.version = SHM_VERSION;
+    want.slots = SHM_SLOTS;
+    want.width = width;
+    want.elem = ELEM_SIZE(elem);
+    want.tile_rows = tile_rows;
+    want.slot_bytes = ((size_t) tile_rows * width * want.elem + SHM_PAGE - 1) & ~(size_t) (SHM_PAGE - 1);
+    want.data_offset = (sizeof(want) + SHM_PAGE - 1) & ~(size_t) (SHM_PAGE - 1);
+    *len = shm_size(&want);
+
+    fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || fstat(fd, &st) < 0)
+        die("shm: cannot open %s", name);
+    if ((size_t) st.st_size == *len) {
+        r = mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (r != MAP_FAILED && r->magic == SHM_MAGIC && r->version == SHM_VERSION && r->slots == want.slots
+            && r->width == want.width && r->elem == want.elem && r->tile_rows == want.tile_rows && !r->stale) {
+            close(fd);
+            return r;
+        }
+        if (r != MAP_FAILED)
+            munmap(r, *len);
+    }
+
+    // another layout: tell its consumers, then start a new object
+    if (st.st_size >= (off_t) sizeof(want)) {
+        r = mmap(NULL, sizeof(want), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (r != MAP_FAILED) {
+            if (r->magic == SHM_MAGIC)
+                __atomic_store_n(&r->stale, 1, __ATOMIC_RELEASE);
+            munmap(r, sizeof(want));
+        }
+    }
+    close(fd);
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 || ftruncate(fd, *len) < 0)
+        die("shm: cannot create %s", name);
+    r = mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (r == MAP_FAILED)
+        die("shm: cannot map %s", name);
+    memcpy(r, &want, sizeof(want));
+    return r;
+}
+
+void
+shm_render(const char *name, mandelbrot_fn function, float Re_min, float Re_max, float Im_min, float Im_max,
+           float threshold, unsigned maxiters, int width, int height, int tile_rows, int elem)
+{
+    uint64_t n, frame, first;
+    uint32_t t1, compute_us = 0;
+    struct shm_ring *r;
+    size_t len;
+    int y0;
+
+    r = shm_create(name, width, elem, tile_rows, &len);
+    frame = __atomic_add_fetch(&r->frames, 1, __ATOMIC_RELAXED);
+    first = n = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+
+    for (y0 = 0; y0 < height; y0 += tile_rows, n++) {
+        struct shm_slot *s = &r->slot[n % r->slots];
+        int rows = y0 + tile_rows < height ? tile_rows : height - y0;
+
+        __atomic_store_n(&s->seq, 2 * n + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        s->frame = frame;
+        s->y0 = y0;
+        s->rows = rows;
+        s->height = height;
+        s->maxiters = maxiters;
+        s->Re_min = Re_min;
+        s->Re_max = Re_max;
+        s->Im_min = Im_min;
+        s->Im_max = Im_max;
+
+        t1 = get_time();
+        function(Re_min, Re_max, Im_min, Im_max, threshold, maxiters, width, height, y0, rows, elem,
+                 shm_payload(r, n));
+        compute_us += get_time() - t1;
+        if (render_cancelled())
+            break;
+
+        _mm_sfence();           // -stream stores are not ordered by the release
+        __atomic_store_n(&s->seq, 2 * n + 2, __ATOMIC_RELEASE);
+        __atomic_store_n(&r->head, n + 1, __ATOMIC_RELEASE);
+    }
+
+    printf("\n  shm: /%s frame %llu, strips %llu..%llu of %d rows, %zu bytes mapped, compute %u us\n",
+           name[0] == '/' ? name + 1 : name, (unsigned long long) frame, (unsigned long long) first,
+           (unsigned long long) n - 1, tile_rows, len, compute_us);
+    munmap(r, len);
+}
+
+// wait for strip n; returns 0 once the ring went stale
+static int
+shm_wait(struct shm_ring *r, uint64_t n)
+{
+    int spins = 0;
+
+    while (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) <= n) {
+        if (__atomic_load_n(&r->stale, __ATOMIC_ACQUIRE))
+            return 0;
+        if (++spins < SHM_SPINS)
+            _mm_pause();
+        else
+            usleep(100);
+    }
+    return 1;
+}
+
+void
+shm_read(const char *name)
+{
+    struct shm_ring head, *r;
+    uint64_t n, frame = 0, strips = 0, dropped = 0;
+    unsigned char *image = NULL;
+    unsigned height = 0, done = 0;
+    char image_name[256];
+    size_t len;
+    FILE *f;
+    int fd;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0 || read(fd, &head, sizeof(head)) != sizeof(head) || head.magic != SHM_MAGIC
+        || head.version != SHM_VERSION)
+        die("shm: %s is not a fractal ring", name);
+    len = shm_size(&head);
+    r = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (r == MAP_FAILED)
+        die("shm: cannot map %s", name);
+    printf("shm: /%s width %u, u%u, %u slots of %u rows, waiting for a frame\n", name[0] == '/' ? name + 1 : name,
+           r->width, r->elem * 8, r->slots, r->tile_rows);
+
+    // the next frame from its first strip on, restarted when a strip is lost
+    for (n = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE); !height || done < height; n++) {
+        const struct shm_slot *s = &r->slot[n % r->slots];
+        struct shm_slot meta;
+        uint64_t seq;
+        size_t pos, count;
+
+        if (!shm_wait(r, n))
+            die("shm: /%s was replaced", name);
+        if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - n > r->slots) {
+            dropped += __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - n - r->slots;
+            n = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - r->slots;
+            height = done = 0;
+        }
+
+        seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (seq != 2 * n + 2) {
+            dropped++;
+            height = done = 0;
+            continue;
+        }
+        memcpy(&meta, s, sizeof(meta));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq) {
+            dropped++;
+            height = done = 0;
+            continue;
+        }
+        if (!height && meta.y0 == 0) {
+            frame = meta.frame;
+            height = meta.height;
+            free(image);
+            image = malloc((size_t) r->width * height);
+            if (!image)
+                die("shm: out of memory");
+        }
+        if (!height || meta.frame != frame)
+            continue;
+
+        // normalize in place from the mapping, then check the slot was not reused meanwhile
+        count = (size_t) meta.rows * r->width;
+        for (pos = 0; pos < count; pos++) {
+            double pixel = (double) load_iters(shm_payload(r, n), pos, r->elem) / (double) (meta.maxiters + 1) * 255;
+
+            image[(size_t) meta.y0 * r->width + pos] = (unsigned char) pixel;
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq) {
+            dropped++;
+            height = done = 0;
+            continue;
+        }
+        strips++;
+        done += meta.rows;
+    }
+
+    sprintf(image_name, "%s.pgm", name[0] == '/' ? name + 1 : name);
+    f = fopen(image_name, "wb");
+    if (!f)
+        die("cannot write %s", image_name);
+    fprintf(f, "P5\n%u %u\n255\n", r->width, height);
+    fwrite(image, 1, (size_t) r->width * height, f);
+    fclose(f);
+    printf("shm: frame %llu, %llu strips read, %llu dropped, %s\n", (unsigned long long) frame,
+           (unsigned long long) strips, (unsigned long long) dropped, image_name);
+
+    free(image);
+    munmap(r, len);
+}
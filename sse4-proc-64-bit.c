@@ -1,14 +1,50 @@
 //=== SSE4 implementation - 64-bit code ==================================
 #include <immintrin.h>
 
+// store 4 iteration counts as u8 (saturating), u16 or u32
+// ELEM_STREAM uses non-temporal stores, consecutive stores along a row fill
+// the write-combining buffers which emit whole cache lines
+static inline void
+SSE_store(__m128i itercount, void *ptr, int elem)
+{
+    __m128i t1;
+
+    switch (elem) {
+    case ELEM_U8:
+    case ELEM_U8 | ELEM_STREAM:
+        t1 = _mm_packus_epi32(itercount, itercount);
+        t1 = _mm_packus_epi16(t1, t1);
+        if (elem & ELEM_STREAM)
+            _mm_stream_si32((int *) ptr, _mm_cvtsi128_si32(t1));
+        else
+            _mm_storeu_si32(ptr, t1);
+        break;
+    case ELEM_U16:
+    case ELEM_U16 | ELEM_STREAM:
+        t1 = _mm_packus_epi32(itercount, itercount);
+        if (elem & ELEM_STREAM)
+            _mm_stream_si64((long long *) ptr, _mm_cvtsi128_si64(t1));
+        else
+            _mm_storel_epi64((__m128i *) ptr, t1);
+        break;
+    case ELEM_U32 | ELEM_STREAM:
+        _mm_stream_si128((__m128i *) ptr, itercount);
+        break;
+    default:
+        _mm_storeu_si128((__m128i *) ptr, itercount);
+        break;
+    }
+}
+
 void
 SSE_mandelbrot(float Re_min, float Re_max,
-               float Im_min, float Im_max, float threshold, int maxiters, int width, int height, uint16_t * data)
+               float Im_min, float Im_max, float threshold, int maxiters,
+               int width, int height, int y0, int rows, int elem, void *data)
 {
     float dRe, dIm;
     int x, y, i;
 
-    uint64_t *ptr = (uint64_t *) data;
+    char *ptr = data;
 
     // step on Re and Im axis
     dRe = (Re_max - Re_min) / width;
@@ -21,7 +57,7 @@ SSE_mandelbrot(float Re_min, float Re_max,
     __m128i itercount;
 
     // 2. Cim
-    __m128 Cim = _mm_set1_ps(Im_min);
+    __m128 Cim = _mm_set1_ps(band_im(Im_min, dIm, y0));
 
     // 3. Re advance every x iteration
     __m128 vec_dRe = _mm_set1_ps(4 * dRe);
@@ -30,7 +66,9 @@ SSE_mandelbrot(float Re_min, float Re_max,
     __m128 vec_dIm = _mm_set1_ps(dIm);
 
     // calculations
-    for (y = 0; y < height; y++) {
+    for (y = 0; y < rows; y++) {
+        if (render_cancelled())
+            break;
 
         Cre = _mm_setr_ps(Re_min, Re_min + dRe, Re_min + 2 * dRe, Re_min + 3 * dRe);
 
@@ -55,8 +93,8 @@ SSE_mandelbrot(float Re_min, float Re_max,
                 Xrm = _mm_mul_ps(Xre, Xim);
             }
 
-            __m128i t1 = _mm_packus_epi32(itercount, itercount);
-            *ptr++ = _mm_cvtsi128_si64(t1);
+            SSE_store(itercount, ptr, elem);
+            ptr += 4 * ELEM_SIZE(elem);
 
             // advance Cre vector
             Cre = _mm_add_ps(Cre, vec_dRe);
@@ -64,5 +102,9 @@ SSE_mandelbrot(float Re_min, float Re_max,
 
         // advance Cim vector
         Cim = _mm_add_ps(Cim, vec_dIm);
+        progress_rows(1, (char *) data + (size_t) y * width * ELEM_SIZE(elem), width, elem);
     }
+
+    // order non-temporal stores (ELEM_STREAM)
+    _mm_sfence();
 }
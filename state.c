@@ -0,0 +1,250 @@
+//=== Deepening state ====================================================
+//
+// -state file keeps, next to the iteration counts, the final z of every
+// pixel which reached maxiters.  The first run renders the frame with the
+// point list procedures and saves the state; a later run on the same window
+// with a larger -i loads the counts and resumes only the unresolved pixels,
+// as one compacted point list, for the additional iterations.  The state is
+// then saved again for the next deepening.
+//
+// file: struct state_header, width * height counts (elem of the run which
+// saved them), then `unresolved` struct state_pixel entries
+
+#define STATE_MAGIC 0x54534d46U // "FMST"
+
+struct state_header {
+    uint32_t magic;
+    uint32_t width, height;
+    float Re_min, Re_max, Im_min, Im_max;
+    float threshold;
+    uint32_t maxiters;
+    uint32_t elem;
+    uint64_t unresolved;
+};
+
+struct state_pixel {
+    uint64_t index;
+    float Zre, Zim;
+};
+
+// one row of the frame as a point list, into a per-row array of the pixels
+// which reached maxiters
+static struct state_pixel *
+state_render_row(mandelbrot_points_fn function, const struct state_header *h, int y, struct points *row, int elem,
+                 void *data, size_t *nres)
+{
+    float dRe = (h->Re_max - h->Re_min) / h->width;
+    float dIm = (h->Im_max - h->Im_min) / h->height;
+    size_t base = (size_t) y * h->width;
+    struct state_pixel *res = NULL;
+    unsigned x, n = 0;
+
+    for (x = 0; x < h->width; x++) {
+        row->Zre[x] = row->Cre[x] = h->Re_min + x * dRe;
+        row->Zim[x] = row->Cim[x] = h->Im_min + y * dIm;
+        row->count[x] = 0;
+    }
+    function(h->threshold, h->maxiters, row->size, row->Cre, row->Cim, row->Zre, row->Zim, row->count);
+
+    for (x = 0; x < h->width; x++) {
+        store_iters((char *) data + (base + x) * ELEM_SIZE(elem), elem, row->count[x]);
+        n += row->count[x] >= h->maxiters;
+    }
+    *nres = n;
+    if (!n)
+        return NULL;
+
+    res = malloc(n * sizeof(*res));
+    if (!res)
+        die("state: out of memory");
+    for (n = 0, x = 0; x < h->width; x++) {
+        if (row->count[x] < h->maxiters)
+            continue;
+        res[n].index = base + x;
+        res[n].Zre = row->Zre[x];
+        res[n].Zim = row->Zim[x];
+        n++;
+    }
+    return res;
+}
+
+static void
+state_save(const char *path, struct state_header *h, int elem, const void *data, const struct state_pixel *res)
+{
+    char tmp[PATH_MAX];
+    FILE *f;
+
+    // write aside and rename, an interrupted save keeps the previous state
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    f = fopen(tmp, "wb");
+    if (!f)
+        die("cannot write state file %s", tmp);
+    h->elem = ELEM_SIZE(elem);
+    if (fwrite(h, sizeof(*h), 1, f) != 1
+        || fwrite(data, ELEM_SIZE(elem), (size_t) h->width * h->height, f) != (size_t) h->width * h->height
+        || fwrite(res, sizeof(*res), h->unresolved, f) != h->unresolved || fclose(f))
+        die("cannot write state file %s", tmp);
+    if (rename(tmp, path))
+        die("cannot rename %s to %s", tmp, path);
+}
+
+// full render of the frame, saving the unresolved pixels
+static void
+state_first(const char *path, mandelbrot_points_fn function, const char *name, struct state_header *h, int elem,
+            void *data)
+{
+    struct state_pixel **rows = calloc(h->height, sizeof(*rows));
+    size_t *nrows = calloc(h->height, sizeof(*nrows));
+    struct state_pixel *res;
+    size_t n = 0, y;
+
+#if defined(_OPENMP)
+#pragma omp parallel
+#endif
+    {
+        struct points row;
+        int yy;
+
+        if (!points_alloc(&row, h->width))
+            die("state: out of memory");
+#if defined(_OPENMP)
+#pragma omp for schedule(dynamic)
+#endif
+        for (yy = 0; yy < (int) h->height; yy++) {
+            if (render_cancelled())
+                continue;
+            rows[yy] = state_render_row(function, h, yy, &row, elem, data, &nrows[yy]);
+            progress_rows(1, (char *) data + (size_t) yy * h->width * ELEM_SIZE(elem), h->width, elem);
+        }
+        points_free(&row);
+    }
+
+    for (y = 0; y < h->height; y++)
+        n += nrows[y];
+    res = malloc(n * sizeof(*res) + 1);
+    for (n = 0, y = 0; y < h->height; y++) {
+        if (nrows[y])
+            memcpy(res + n, rows[y], nrows[y] * sizeof(*res));
+        n += nrows[y];
+        free(rows[y]);
+    }
+    h->unresolved = n;
+    if (!render_cancelled()) {
+        state_save(path, h, elem, data, res);
+        printf("\n  state %s: %s points, %zu pixels unresolved at maxiters=%u\n", path, name, n, h->maxiters);
+    }
+
+    free(res);
+    free(rows);
+    free(nrows);
+}
+
+// the unresolved pixels in parallel chunks of the list, which is in frame
+// order: a chunk reports the rows from the end of the previous chunk to the
+// row of its last pixel (the last chunk to the end of the frame)
+static void
+state_run(mandelbrot_points_fn function, const struct state_header *h, const struct state_pixel *res, int iters,
+          struct points *p)
+{
+    long k;
+
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (k = 0; k < (long) p->size; k += POINTS_CHUNK) {
+        int len = p->size - k < POINTS_CHUNK ? p->size - k : POINTS_CHUNK;
+        size_t last = k + len < (long) p->n ? (size_t) (k + len) : p->n;
+        unsigned from = k ? res[k - 1].index / h->width + 1 : 0;
+        unsigned to = k + len < (long) p->size ? res[last - 1].index / h->width + 1 : h->height;
+
+        if (render_cancelled())
+            continue;
+        function(h->threshold, iters, len, p->Cre + k, p->Cim + k, p->Zre + k, p->Zim + k, p->count + k);
+        progress_rows(to - from, p->count + k, last - k, ELEM_U32);
+    }
+}
+
+// counts from the state file, resume the unresolved pixels up to maxiters
+static void
+state_resume(const char *path, mandelbrot_points_fn function, const char *name, FILE *f, struct state_header *h,
+             unsigned maxiters, int elem, void *data)
+{
+    size_t npix = (size_t) h->width * h->height, k, n;
+    float dRe = (h->Re_max - h->Re_min) / h->width;
+    float dIm = (h->Im_max - h->Im_min) / h->height;
+    unsigned saved = h->maxiters;
+    struct state_pixel *res = malloc(h->unresolved * sizeof(*res) + 1);
+    void *counts = malloc(npix * h->elem);
+    struct points p;
+
+    if (!res || !counts)
+        die("state: out of memory");
+    if (fread(counts, h->elem, npix, f) != npix || fread(res, sizeof(*res), h->unresolved, f) != h->unresolved)
+        die("state file %s is truncated", path);
+    for (k = 0; k < npix; k++)
+        store_iters((char *) data + k * ELEM_SIZE(elem), elem, load_iters(counts, k, h->elem));
+    free(counts);
+
+    if (!points_alloc(&p, h->unresolved))
+        die("state: out of memory");
+    for (k = 0; k < h->unresolved; k++) {
+        p.Cre[k] = h->Re_min + (res[k].index % h->width) * dRe;
+        p.Cim[k] = h->Im_min + (res[k].index / h->width) * dIm;
+        p.Zre[k] = res[k].Zre;
+        p.Zim[k] = res[k].Zim;
+        p.count[k] = saved;
+    }
+    state_run(function, h, res, maxiters - saved, &p);
+    if (render_cancelled()) {
+        // the state file keeps the previous depth
+        points_free(&p);
+        free(res);
+        return;
+    }
+
+    // scatter the new counts, keep the pixels still at the limit
+    for (n = 0, k = 0; k < h->unresolved; k++) {
+        store_iters((char *) data + res[k].index * ELEM_SIZE(elem), elem, p.count[k]);
+        if (p.count[k] < maxiters)
+            continue;
+        res[n].index = res[k].index;
+        res[n].Zre = p.Zre[k];
+        res[n].Zim = p.Zim[k];
+        n++;
+    }
+    printf("\n  state %s: %s points, resumed %zu pixels from maxiters=%u, %zu unresolved at maxiters=%u\n", path,
+           name, (size_t) h->unresolved, saved, n, maxiters);
+
+    h->maxiters = maxiters;
+    h->unresolved = n;
+    state_save(path, h, elem, data, res);
+    points_free(&p);
+    free(res);
+}
+
+void
+state_render(const char *path, mandelbrot_points_fn function, const char *name, float Re_min, float Re_max,
+             float Im_min, float Im_max, float threshold, unsigned maxiters, unsigned width, unsigned height, int elem,
+             void *data)
+{
+    struct state_header want = { STATE_MAGIC, width, height, Re_min, Re_max, Im_min, Im_max, threshold, maxiters, 0, 0 };
+    struct state_header h;
+    FILE *f = fopen(path, "rb");
+
+    elem = ELEM_SIZE(elem);
+    if (!f) {
+        state_first(path, function, name, &want, elem, data);
+        return;
+    }
+
+    if (fread(&h, sizeof(h), 1, f) != 1 || h.magic != STATE_MAGIC)
+        die("%s is not a state file", path);
+    if (h.width != width || h.height != height || h.Re_min != Re_min || h.Re_max != Re_max
+        || h.Im_min != Im_min || h.Im_max != Im_max || h.threshold != threshold)
+        die("state file %s was saved for another frame", path);
+    if (h.maxiters >= maxiters)
+        die("state file %s is already at maxiters=%u", path, h.maxiters);
+
+    state_resume(path, function, name, f, &h, maxiters, elem, data);
+    fclose(f);
+}
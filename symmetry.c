@@ -0,0 +1,61 @@
+//=== Real axis symmetry =================================================
+//
+// the set is symmetric about Im=0: row y and row k-y, with
+// k = -2 * Im_min / dIm, hold conjugate points and the same counts.  When
+// k is an integer, -symmetry computes rows [0, a) with a just past k/2,
+// copies rows [a, b) from their mirror rows, and computes the asymmetric
+// remainder [b, height) if the window extends further on one side.  Both
+// computed ranges keep an even number of rows for the stitched procedures.
+
+#include <math.h>
+
+#define SYMMETRY_EPSILON 1e-3   // tolerance on k, in rows
+
+// compute rows [y0, y1) of the frame
+static void
+symmetry_rows(mandelbrot_fn function, float Re_min, float Re_max, float Im_min, float Im_max, float threshold,
+              int maxiters, int width, int height, int y0, int y1, int elem, void *data)
+{
+    if (y1 <= y0)
+        return;
+    function(Re_min, Re_max, Im_min, Im_max, threshold, maxiters, width, height, y0, y1 - y0, elem,
+             (char *) data + (size_t) y0 * width * ELEM_SIZE(elem));
+}
+
+void
+symmetry_render(mandelbrot_fn function, float Re_min, float Re_max, float Im_min, float Im_max, float threshold,
+                int maxiters, int width, int height, int elem, void *data)
+{
+    float dIm = (Im_max - Im_min) / height;
+    double kf = -2.0 * Im_min / dIm;
+    long k = lround(kf);
+    size_t row = (size_t) width * ELEM_SIZE(elem);
+    int a, b, y;
+
+    // no mirrored pair inside the frame
+    if (fabs(kf - k) > SYMMETRY_EPSILON || k <= 0 || k / 2 + 1 >= height) {
+        function(Re_min, Re_max, Im_min, Im_max, threshold, maxiters, width, height, 0, height, elem, data);
+        printf("\n  symmetry: none, %d rows computed\n", height);
+        return;
+    }
+
+    a = (k / 2 + 2) & ~1;
+    b = k + 1 < height ? k + 1 : height;
+    if ((height - b) % 2)
+        b--;
+    if (b < a)
+        b = a;
+
+    symmetry_rows(function, Re_min, Re_max, Im_min, Im_max, threshold, maxiters, width, height, 0, a, elem, data);
+
+#if defined(_OPENMP)
+#pragma omp parallel for
+#endif
+    for (y = a; y < b; y++)
+        memcpy((char *) data + y * row, (char *) data + (k - y) * row, row);
+    progress_rows(b - a, NULL, 0, 0);       // rows done, no iterations executed
+
+    symmetry_rows(function, Re_min, Re_max, Im_min, Im_max, threshold, maxiters, width, height, b, height, elem,
+                  data);
+    printf("\n  symmetry: axis at row %ld, %d rows computed, %d mirrored\n", k / 2, height - (b - a), b - a);
+}
@@ -0,0 +1,418 @@
+//=== Tiled pyramid output ===============================================
+//
+// -tiled file renders the frame in bands of TILED_SIZE rows and writes
+// them as TILED_SIZE x TILED_SIZE tiles of iteration counts, raw or zlib
+// compressed (-compress), followed by a pyramid of 2x2 averaged levels
+// down to a single tile.  Only one band per level is kept in memory, tiles
+// are encoded and written by the openmp threads as soon as a band is done.
+//
+// file: struct tiled_header, the index (one struct tiled_entry per tile,
+// level 0 first, row major), then the tiles.  Raw tiles start on a 4 KB
+// boundary; a viewer maps the file and reads any tile in constant time.
+// Edge tiles are padded with zeros.
+
+#include <zlib.h>
+
+#define TILED_MAGIC      0x4c544d46U     // "FMTL"
+#define TILED_SIZE       256
+#define TILED_MAX_LEVELS 24
+#define TILED_ALIGN      4096
+
+enum { TILE_RAW, TILE_ZLIB };
+
+struct tiled_header {
+    uint32_t magic;
+    uint32_t width, height;
+    uint32_t tile_size;
+    uint32_t levels;
+    uint32_t elem;
+    uint32_t maxiters;
+    float Re_min, Re_max, Im_min, Im_max;
+    uint32_t ntiles;
+};
+
+struct tiled_entry {
+    uint64_t offset;
+    uint32_t bytes;
+    uint32_t kind;
+};
+
+struct tiled_levels {
+    unsigned levels;
+    unsigned width[TILED_MAX_LEVELS], height[TILED_MAX_LEVELS];
+    unsigned tiles_x[TILED_MAX_LEVELS], tiles_y[TILED_MAX_LEVELS];
+    size_t base[TILED_MAX_LEVELS];      // index of the first tile of the level
+    size_t ntiles;
+};
+
+// level l is the frame downsampled by 2^l, the last level fits in one tile
+static void
+tiled_geometry(const struct tiled_header *h, struct tiled_levels *g)
+{
+    unsigned w = h->width, ht = h->height, l;
+
+    g->ntiles = 0;
+    for (l = 0; l < TILED_MAX_LEVELS; l++) {
+        g->width[l] = w;
+        g->height[l] = ht;
+        g->tiles_x[l] = (w + h->tile_size - 1) / h->tile_size;
+        g->tiles_y[l] = (ht + h->tile_size - 1) / h->tile_size;
+        g->base[l] = g->ntiles;
+        g->ntiles += (size_t) g->tiles_x[l] * g->tiles_y[l];
+        if (w <= h->tile_size && ht <= h->tile_size)
+            break;
+        w = (w + 1) / 2;
+        ht = (ht + 1) / 2;
+    }
+    g->levels = l + 1;
+}
+
+//--- writer ---------------------------------------------------------------
+
+static struct tiled_writer {
+    int fd;
+    int compress;
+    struct tiled_header h;
+    struct tiled_levels g;
+    struct tiled_entry *index;
+    char *band[TILED_MAX_LEVELS];       // TILED_SIZE rows of each level
+    unsigned band_rows[TILED_MAX_LEVELS];       // rows filled
+    unsigned band_y[TILED_MAX_LEVELS];  // tile row of the band
+    unsigned done_rows[TILED_MAX_LEVELS];
+    uint64_t next_offset;       // atomic, end of the file
+    uint64_t stored;            // atomic, bytes of tile data
+} tw;
+
+static void
+tiled_write(const void *buf, size_t len, uint64_t offset)
+{
+    size_t off = 0;
+
+    while (off < len) {
+        ssize_t n = pwrite(tw.fd, (const char *) buf + off, len - off, offset + off);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            die("tiled: write failed");
+        off += n;
+    }
+}
+
+// file range for a tile, the end of the file moves with a compare and swap
+static uint64_t
+tiled_reserve(size_t bytes, uint64_t align)
+{
+    uint64_t old = __atomic_load_n(&tw.next_offset, __ATOMIC_RELAXED), start;
+
+    do
+        start = (old + align - 1) & ~(align - 1);
+    while (!__atomic_compare_exchange_n(&tw.next_offset, &old, start + bytes, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return start;
+}
+
+// encode and write the tiles of the band of level l
+static void
+tiled_flush(unsigned l)
+{
+    unsigned size = tw.h.tile_size, elem = tw.h.elem;
+    size_t tile_bytes = (size_t) size * size * elem;
+    size_t row_bytes = (size_t) tw.g.width[l] * elem;
+    int tx;
+
+#if defined(_OPENMP)
+#pragma omp parallel
+#endif
+    {
+        unsigned char *tile = malloc(tile_bytes);
+        uLongf zcap = compressBound(tile_bytes);
+        unsigned char *z = tw.compress ? malloc(zcap) : NULL;
+
+        if (!tile || (tw.compress && !z))
+            die("tiled: out of memory");
+
+#if defined(_OPENMP)
+#pragma omp for schedule(dynamic)
+#endif
+        for (tx = 0; tx < (int) tw.g.tiles_x[l]; tx++) {
+            struct tiled_entry *e = &tw.index[tw.g.base[l] + (size_t) tw.band_y[l] * tw.g.tiles_x[l] + tx];
+            size_t x0 = (size_t) tx * size * elem;
+            size_t w = x0 + size * elem <= row_bytes ? size * elem : row_bytes - x0;
+            const unsigned char *src = tile;
+            uLongf zlen = zcap;
+            unsigned y;
+
+            for (y = 0; y < size; y++) {
+                memcpy(tile + y * size * elem, tw.band[l] + y * row_bytes + x0, w);
+                memset(tile + y * size * elem + w, 0, size * elem - w);
+            }
+
+            e->kind = TILE_RAW;
+            e->bytes = tile_bytes;
+            if (tw.compress && compress2(z, &zlen, tile, tile_bytes, 1) == Z_OK && zlen < tile_bytes) {
+                e->kind = TILE_ZLIB;
+                e->bytes = zlen;
+                src = z;
+            }
+
+            e->offset = tiled_reserve(e->bytes, e->kind == TILE_RAW ? TILED_ALIGN : 1);
+            __atomic_fetch_add(&tw.stored, e->bytes, __ATOMIC_RELAXED);
+            tiled_write(src, e->bytes, e->offset);
+        }
+        free(tile);
+        free(z);
+    }
+}
+
+// 2x2 average of the band of level l into the band of level l + 1
+static void
+tiled_downsample(unsigned l, unsigned rows)
+{
+    unsigned elem = tw.h.elem;
+    unsigned sw = tw.g.width[l], dw = tw.g.width[l + 1];
+    unsigned dy0 = tw.band_rows[l + 1];
+    int y;
+
+#if defined(_OPENMP)
+#pragma omp parallel for
+#endif
+    for (y = 0; y < (int) (rows + 1) / 2; y++) {
+        unsigned x;
+
+        for (x = 0; x < dw; x++) {
+            uint64_t sum = 0;
+            unsigned n = 0, dx, dy;
+
+            for (dy = 0; dy < 2 && 2 * y + dy < rows; dy++)
+                for (dx = 0; dx < 2 && 2 * x + dx < sw; dx++, n++)
+                    sum += load_iters(tw.band[l], (size_t) (2 * y + dy) * sw + 2 * x + dx, elem);
+            store_iters(tw.band[l + 1] + ((size_t) (dy0 + y) * dw + x) * elem, elem, (sum + n / 2) / n);
+        }
+    }
+}
+
+// rows of level l are in its band, write full (or last) bands and carry on
+// to the next level
+static void
+tiled_band_done(unsigned l, unsigned rows)
+{
+    unsigned size = tw.h.tile_size;
+
+    tw.band_rows[l] += rows;
+    tw.done_rows[l] += rows;
+    if (tw.band_rows[l] < size && tw.done_rows[l] < tw.g.height[l])
+        return;
+
+    // padding rows of the last band
+    memset(tw.band[l] + (size_t) tw.band_rows[l] * tw.g.width[l] * tw.h.elem, 0,
+           (size_t) (size - tw.band_rows[l]) * tw.g.width[l] * tw.h.elem);
+    tiled_flush(l);
+    if (l + 1 < tw.g.levels) {
+        rows = tw.band_rows[l];
+        tiled_downsample(l, rows);
+        tiled_band_done(l + 1, (rows + 1) / 2);
+    }
+    tw.band_rows[l] = 0;
+    tw.band_y[l]++;
+}
+
+void
+tiled_render(const char *path, int compress, mandelbrot_fn function, float Re_min, float Re_max, float Im_min,
+             float Im_max, float threshold, unsigned maxiters, unsigned width, unsigned height, int elem)
+{
+    uint64_t raw;
+    unsigned y0, l;
+
+    memset(&tw, 0, sizeof(tw));
+    tw.compress = compress;
+    tw.h.magic = TILED_MAGIC;
+    tw.h.width = width;
+    tw.h.height = height;
+    tw.h.tile_size = TILED_SIZE;
+    tw.h.elem = ELEM_SIZE(elem);
+    tw.h.maxiters = maxiters;
+    tw.h.Re_min = Re_min;
+    tw.h.Re_max = Re_max;
+    tw.h.Im_min = Im_min;
+    tw.h.Im_max = Im_max;
+    tiled_geometry(&tw.h, &tw.g);
+    tw.h.levels = tw.g.levels;
+    tw.h.ntiles = tw.g.ntiles;
+
+    tw.index = calloc(tw.g.ntiles, sizeof(*tw.index));
+    for (l = 0; l < tw.g.levels; l++) {
+        tw.band[l] = aligned_alloc(64, ((size_t) TILED_SIZE * tw.g.width[l] * tw.h.elem + 63) & ~(size_t) 63);
+        if (!tw.band[l])
+            die("tiled: out of memory");
+    }
+    if (!tw.index)
+        die("tiled: out of memory");
+
+    tw.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (tw.fd < 0)
+        die("cannot create %s", path);
+    tw.next_offset = (sizeof(tw.h) + tw.g.ntiles * sizeof(*tw.index) + TILED_ALIGN - 1) & ~(uint64_t) (TILED_ALIGN - 1);
+
+    for (y0 = 0; y0 < height && !render_cancelled(); y0 += TILED_SIZE) {
+        unsigned rows = y0 + TILED_SIZE < height ? TILED_SIZE : height - y0;
+
+        function(Re_min, Re_max, Im_min, Im_max, threshold, maxiters, width, height, y0, rows, elem, tw.band[0]);
+        tiled_band_done(0, rows);
+    }
+
+    // a cancelled render leaves no file with holes in the index
+    if (render_cancelled()) {
+        close(tw.fd);
+        unlink(path);
+    } else {
+        tiled_write(&tw.h, sizeof(tw.h), 0);
+        tiled_write(tw.index, tw.g.ntiles * sizeof(*tw.index), sizeof(tw.h));
+        if (ftruncate(tw.fd, tw.next_offset) < 0 || close(tw.fd))
+            die("cannot write %s", path);
+
+        raw = (uint64_t) tw.g.ntiles * TILED_SIZE * TILED_SIZE * tw.h.elem;
+        printf("\n  tiled %s: %u levels, %zu tiles, %llu bytes of %llu raw\n", path, tw.g.levels, tw.g.ntiles,
+               (unsigned long long) tw.stored, (unsigned long long) raw);
+    }
+
+    for (l = 0; l < tw.g.levels; l++)
+        free(tw.band[l]);
+    free(tw.index);
+}
+
+//--- reader ---------------------------------------------------------------
+
+struct tiled_map {
+    int fd;
+    size_t len;
+    const unsigned char *map;
+    const struct tiled_header *h;
+    const struct tiled_entry *index;
+    struct tiled_levels g;
+};
+
+void
+tiled_close(struct tiled_map *m)
+{
+    munmap((void *) m->map, m->len);
+    close(m->fd);
+}
+
+// header, index and every tile must lie within the file
+static int
+tiled_valid(const struct tiled_map *m)
+{
+    const struct tiled_header *h = m->h;
+    uint64_t tile_bytes = (uint64_t) h->tile_size * h->tile_size * h->elem;
+    size_t t;
+
+    if (h->magic != TILED_MAGIC || !h->width || !h->height || !h->tile_size || h->tile_size > 65536
+        || (h->elem != ELEM_U8 && h->elem != ELEM_U16 && h->elem != ELEM_U32))
+        return 0;
+    if (m->g.ntiles != h->ntiles || m->g.levels != h->levels
+        || m->g.ntiles > (m->len - sizeof(*h)) / sizeof(struct tiled_entry))
+        return 0;
+    for (t = 0; t < m->g.ntiles; t++) {
+        const struct tiled_entry *e = &m->index[t];
+
+        if (e->offset > m->len || e->bytes > m->len - e->offset)
+            return 0;
+        if (e->kind == TILE_RAW ? e->bytes != tile_bytes : e->kind != TILE_ZLIB || !e->bytes)
+            return 0;
+    }
+    return 1;
+}
+
+int
+tiled_open(struct tiled_map *m, const char *path)
+{
+    struct stat st;
+
+    m->fd = open(path, O_RDONLY);
+    if (m->fd < 0)
+        return 0;
+    if (fstat(m->fd, &st) || (size_t) st.st_size < sizeof(struct tiled_header)) {
+        close(m->fd);
+        return 0;
+    }
+    m->len = st.st_size;
+    m->map = mmap(NULL, m->len, PROT_READ, MAP_SHARED, m->fd, 0);
+    if (m->map == MAP_FAILED) {
+        close(m->fd);
+        return 0;
+    }
+    m->h = (const struct tiled_header *) m->map;
+    m->index = (const struct tiled_entry *) (m->map + sizeof(*m->h));
+    if (m->h->tile_size)
+        tiled_geometry(m->h, &m->g);
+    if (!tiled_valid(m)) {
+        tiled_close(m);
+        return 0;
+    }
+    return 1;
+}
+
+// counts of a tile, raw tiles point into the mapping, compressed ones are
+// inflated into buf (tile_size^2 elements)
+const void *
+tiled_tile(const struct tiled_map *m, unsigned level, unsigned tx, unsigned ty, void *buf)
+{
+    const struct tiled_entry *e = &m->index[m->g.base[level] + (size_t) ty * m->g.tiles_x[level] + tx];
+    uLongf len = (uLongf) m->h->tile_size * m->h->tile_size * m->h->elem;
+
+    if (e->kind == TILE_RAW)
+        return m->map + e->offset;
+    if (uncompress(buf, &len, m->map + e->offset, e->bytes) != Z_OK
+        || len != (uLongf) m->h->tile_size * m->h->tile_size * m->h->elem)
+        die("tiled: corrupt tile %u,%u of level %u", tx, ty, level);
+    return buf;
+}
+
+// -extract file level,x,y,w,h writes a region of a level as extract.pgm,
+// touching only the tiles it covers
+void
+tiled_extract(const char *path, const char *spec)
+{
+    struct tiled_map m;
+    unsigned level, x0, y0, w, h, x, y, size;
+    unsigned cached_x = UINT_MAX, cached_y = UINT_MAX;
+    const void *tile = NULL;
+    void *buf;
+    FILE *f;
+
+    if (sscanf(spec, "%u,%u,%u,%u,%u", &level, &x0, &y0, &w, &h) != 5)
+        die("-extract expects level,x,y,width,height");
+    if (!tiled_open(&m, path))
+        die("%s is not a tiled file", path);
+    if (level >= m.g.levels || !w || !h || x0 + w > m.g.width[level] || y0 + h > m.g.height[level])
+        die("region outside of level %u (%u x %u, %u levels)", level, level < m.g.levels ? m.g.width[level] : 0,
+            level < m.g.levels ? m.g.height[level] : 0, m.g.levels);
+
+    size = m.h->tile_size;
+    buf = malloc((size_t) size * size * m.h->elem);
+    f = fopen("extract.pgm", "wb");
+    if (!buf || !f)
+        die("cannot write extract.pgm");
+    fprintf(f, "P5\n%u %u\n255\n", w, h);
+    for (y = y0; y < y0 + h; y++) {
+        for (x = x0; x < x0 + w; x++) {
+            unsigned pix;
+            unsigned char grey;
+
+            if (x / size != cached_x || y / size != cached_y) {
+                cached_x = x / size;
+                cached_y = y / size;
+                tile = tiled_tile(&m, level, cached_x, cached_y, buf);
+            }
+            pix = load_iters(tile, (size_t) (y % size) * size + x % size, m.h->elem);
+            grey = pix >= m.h->maxiters ? 255 : pix * 255 / (m.h->maxiters ? m.h->maxiters : 1);
+
+            fputc(grey, f);
+        }
+    }
+    fclose(f);
+    printf("Extract %u x %u at %u,%u of level %u (%u x %u) to extract.pgm\n", w, h, x0, y0, level,
+           m.g.width[level], m.g.height[level]);
+    free(buf);
+    tiled_close(&m);
+}
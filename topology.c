@@ -0,0 +1,280 @@
+//=== CPU topology and thread placement ==================================
+//
+// topology is read from sysfs, -pin places openmp threads on cpus:
+//   compact  fill both hyperthreads of a core, then the next core, then the next socket
+//   scatter  one thread per core first, alternating sockets, hyperthreads last
+//   smt      hyperthread pairs on the same core, pairs alternating sockets
+// with -pin, the rows of the frame are first touched by the thread which
+// will compute them, so that pages land on the socket of that thread.
+
+#include <sched.h>
+#include <pthread.h>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+#ifndef SYSFS_ROOT
+#define SYSFS_ROOT "/sys/devices/system"
+#endif
+
+#define MAX_CPUS 1024
+#define MAX_NODES 64
+
+enum pin_policy { PIN_NONE, PIN_COMPACT, PIN_SCATTER, PIN_SMT };
+
+static const char *const pin_names[] = { "none", "compact", "scatter", "smt" };
+
+struct cpu_info {
+    int cpu;
+    int package;
+    int core;
+    int core_rank;              // index of the core within its package
+    int thread;                 // index of the hyperthread within its core
+    int node;
+};
+
+static struct topology {
+    int ncpus;
+    int ncores;
+    int npackages;
+    int nnodes;
+    struct cpu_info cpus[MAX_CPUS];
+} topo;
+
+static int placement[MAX_CPUS];
+static int nplaced;
+static cpu_set_t unpinned;      // affinity of the process before any pinning
+
+static int
+sysfs_read_int(const char *path, int fallback)
+{
+    FILE *f = fopen(path, "rt");
+    int v;
+
+    if (!f)
+        return fallback;
+    if (fscanf(f, "%d", &v) != 1)
+        v = fallback;
+    fclose(f);
+    return v;
+}
+
+// parse a cpu list ("0-3,8-11") into a boolean array
+static int
+sysfs_read_cpulist(const char *path, char *set)
+{
+    FILE *f = fopen(path, "rt");
+    int a, b, c;
+
+    if (!f)
+        return 0;
+    memset(set, 0, MAX_CPUS);
+    while (fscanf(f, "%d", &a) == 1) {
+        b = a;
+        c = fgetc(f);
+        if (c == '-') {
+            if (fscanf(f, "%d", &b) != 1)
+                break;
+            c = fgetc(f);
+        }
+        while (a <= b && a < MAX_CPUS)
+            set[a++] = 1;
+        if (c != ',')
+            break;
+    }
+    fclose(f);
+    return 1;
+}
+
+void
+topology_discover(void)
+{
+    char path[256];
+    char set[MAX_CPUS];
+    int cpu, i, j, n;
+
+    memset(&topo, 0, sizeof(topo));
+    if (sched_getaffinity(0, sizeof(unpinned), &unpinned))
+        CPU_ZERO(&unpinned);
+
+    if (!sysfs_read_cpulist(SYSFS_ROOT "/cpu/online", set)) {
+        memset(set, 0, sizeof(set));
+        set[0] = 1;
+    }
+
+    for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct cpu_info *c;
+
+        if (!set[cpu])
+            continue;
+        c = &topo.cpus[topo.ncpus++];
+        c->cpu = cpu;
+        snprintf(path, sizeof(path), SYSFS_ROOT "/cpu/cpu%d/topology/physical_package_id", cpu);
+        c->package = sysfs_read_int(path, 0);
+        snprintf(path, sizeof(path), SYSFS_ROOT "/cpu/cpu%d/topology/core_id", cpu);
+        c->core = sysfs_read_int(path, cpu);
+    }
+
+    // numa nodes, a machine without node directories is a single node
+    for (n = 0; n < MAX_NODES; n++) {
+        snprintf(path, sizeof(path), SYSFS_ROOT "/node/node%d/cpulist", n);
+        if (!sysfs_read_cpulist(path, set))
+            continue;
+        topo.nnodes++;
+        for (i = 0; i < topo.ncpus; i++)
+            if (set[topo.cpus[i].cpu])
+                topo.cpus[i].node = n;
+    }
+    if (!topo.nnodes)
+        topo.nnodes = 1;
+
+    for (i = 0; i < topo.ncpus; i++) {
+        struct cpu_info *c = &topo.cpus[i];
+
+        for (j = 0; j < i; j++)
+            c->thread += topo.cpus[j].package == c->package && topo.cpus[j].core == c->core;
+        topo.ncores += c->thread == 0;
+    }
+
+    for (i = 0; i < topo.ncpus; i++) {
+        struct cpu_info *c = &topo.cpus[i];
+        int first_in_package = 1;
+
+        // distinct cores of the package with a lower core id
+        for (j = 0; j < topo.ncpus; j++) {
+            struct cpu_info *o = &topo.cpus[j];
+
+            if (o->package != c->package)
+                continue;
+            first_in_package &= j >= i;
+            c->core_rank += o->core < c->core && o->thread == 0;
+        }
+        topo.npackages += first_in_package;
+    }
+}
+
+static enum pin_policy sort_policy;
+
+static int
+cmp_placement(const void *a, const void *b)
+{
+    const struct cpu_info *x = a, *y = b;
+    int kx[3], ky[3], i;
+
+    switch (sort_policy) {
+    case PIN_SCATTER:
+        kx[0] = x->thread, kx[1] = x->core_rank, kx[2] = x->package;
+        ky[0] = y->thread, ky[1] = y->core_rank, ky[2] = y->package;
+        break;
+    case PIN_SMT:
+        kx[0] = x->core_rank, kx[1] = x->package, kx[2] = x->thread;
+        ky[0] = y->core_rank, ky[1] = y->package, ky[2] = y->thread;
+        break;
+    default:
+        kx[0] = x->package, kx[1] = x->core_rank, kx[2] = x->thread;
+        ky[0] = y->package, ky[1] = y->core_rank, ky[2] = y->thread;
+        break;
+    }
+    for (i = 0; i < 3; i++)
+        if (kx[i] != ky[i])
+            return kx[i] - ky[i];
+    return x->cpu - y->cpu;
+}
+
+enum pin_policy
+pin_policy_parse(const char *name)
+{
+    int p;
+
+    for (p = PIN_COMPACT; p <= PIN_SMT; p++)
+        if (!strcasecmp(name, pin_names[p]))
+            return p;
+    die("unknown pinning policy %s (compact, scatter, smt)", name);
+    return PIN_NONE;
+}
+
+static int
+pin_to(const struct cpu_info *c)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(c->cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// pin every openmp thread, libgomp keeps the same threads for later
+// parallel regions of the same size
+void
+pin_threads(enum pin_policy policy)
+{
+    static struct cpu_info order[MAX_CPUS];
+
+    memcpy(order, topo.cpus, topo.ncpus * sizeof(order[0]));
+    sort_policy = policy;
+    qsort(order, topo.ncpus, sizeof(order[0]), cmp_placement);
+
+#if defined(_OPENMP)
+    nplaced = omp_get_max_threads();
+    if (nplaced > MAX_CPUS)
+        nplaced = MAX_CPUS;
+#pragma omp parallel num_threads(nplaced)
+    {
+        int t = omp_get_thread_num();
+
+        pin_to(&order[t % topo.ncpus]);
+        placement[t] = t % topo.ncpus;
+    }
+#else
+    nplaced = 1;
+    pin_to(&order[0]);
+    placement[0] = 0;
+#endif
+
+    // keep the cpu entries, placement[] indexes the sorted order
+    memcpy(topo.cpus, order, topo.ncpus * sizeof(order[0]));
+}
+
+// undo pin_threads: the openmp threads may run on any cpu of the process again
+void
+pin_reset(void)
+{
+    if (!CPU_COUNT(&unpinned))
+        return;
+#if defined(_OPENMP)
+#pragma omp parallel
+#endif
+    pthread_setaffinity_np(pthread_self(), sizeof(unpinned), &unpinned);
+    nplaced = 0;
+}
+
+void
+print_placement(const char *policy)
+{
+    int t;
+
+    printf("Topology %d cpus, %d cores, %d sockets, %d nodes; %s:", topo.ncpus, topo.ncores,
+           topo.npackages, topo.nnodes, policy);
+    for (t = 0; t < nplaced; t++) {
+        const struct cpu_info *c = &topo.cpus[placement[t]];
+
+        printf(" %d:cpu%d/node%d", t, c->cpu, c->node);
+    }
+    putchar('\n');
+}
+
+// touch each row pair from the thread which computes it in the stitched
+// procedures (same loop, same static schedule)
+void
+first_touch(void *data, int width, int height, int elem)
+{
+    size_t row = (size_t) width * ELEM_SIZE(elem);
+    int y;
+
+#if defined(_OPENMP)
+#pragma omp parallel for
+#endif
+    for (y = 0; y < height; y += 2)
+        memset((char *) data + y * row, 0, 2 * row);
+}